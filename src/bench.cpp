@@ -0,0 +1,389 @@
+#include <QtGui>
+
+#include "tmapwrapper.h"
+#include "textreader.h"
+#include "textwriter.h"
+#include "maprenderer.h"
+#include "facebatches.h"
+#include "pointlocator.h"
+#include "pointset.h"
+#include "generator.h"
+
+#include <algorithm>
+
+// Microbenchmarks of loading, saving, locating and rendering, run over
+// synthetic maps of a few sizes. The results are printed as CSV, one line
+// per benchmark and size, so runs on different commits can be compared.
+
+static const char usage[] =
+    "Usage: wte-bench [OPTIONS] [BENCHMARK...]\n"
+    "\n"
+    "Runs the named benchmarks, or all of them, on a synthetic map of each\n"
+    "size and prints the timings as CSV.\n"
+    "\n"
+    "Benchmarks:\n"
+    "  read              read_triangulation\n"
+    "  stream-read       operator>> on a QTextStream\n"
+    "  write             write_triangulation of a map as loaded\n"
+    "  write-edited      write_triangulation of a map without adjacency\n"
+    "  stream-write      operator<< on a QTextStream\n"
+    "  locate            face_containing_point\n"
+    "  locate-grid       FaceGrid::faceContaining\n"
+    "  locate-batch      locate_points\n"
+    "  nearest           Closest vertex to a point, as for tooltips\n"
+    "  boundary          Bounding box of the vertices, as the point set\n"
+    "                    editor works it out\n"
+    "  render            Drawing the whole map into an image\n"
+    "\n"
+    "Options:\n"
+    "  --sizes N,...     Numbers of faces in the maps\n"
+    "                    (default: 10000,100000,1000000)\n"
+    "  --repeat N        Times to run each benchmark (default: 5)\n"
+    "  --seed N          Seed for the maps and queries (default: 1)\n"
+    "  --image WxH       Size of the rendered image (default: 1024x768)\n"
+    "\n"
+    "Each line of output gives the benchmark, the number of faces, the number\n"
+    "of operations per run, the best and median run time in seconds, the\n"
+    "median time per operation in nanoseconds and, for the file benchmarks,\n"
+    "the median throughput in MB/s.\n";
+
+// Keeps the compiler from dropping work whose results are never used.
+static volatile qint64 sink;
+
+// A small linear congruential generator, so that the queries are the same
+// on every platform.
+class Random
+{
+public:
+    Random(quint32 seed) : state(seed * 2654435761u + 1) {}
+
+    quint32 next() {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        return quint32(state >> 32);
+    }
+
+    // Uniform in [0, 1).
+    qreal real() { return next() / 4294967296.0; }
+
+private:
+    quint64 state;
+};
+
+// Everything the benchmarks of one size work on, set up before any timing.
+struct Fixture {
+    QString path;
+    QString output_path;
+    qint64 file_size;
+    TMapWrapper tmap_wrapper;
+    TriangulatedMap edited;
+    FaceBatches batches;
+    QVector<QPointF> queries;
+    // How many of the queries the brute force search answers.
+    int n_slow_queries;
+    QImage image;
+};
+
+// Runs one benchmark once. Returns the number of operations done, or 0 if it
+// failed, and sets bytes to the amount of file read or written, if any.
+typedef qint64 (*BenchFunction)(Fixture &, qint64 &bytes);
+
+static qint64 bench_read(Fixture &fixture, qint64 &bytes)
+{
+    TriangulatedMap tmap;
+    QString error;
+    if (!read_triangulation(fixture.path, tmap, &error)) {
+        qWarning() << error;
+        return 0;
+    }
+    sink = tmap.faces.size();
+    bytes = fixture.file_size;
+    return 1;
+}
+
+static qint64 bench_stream_read(Fixture &fixture, qint64 &bytes)
+{
+    QFile file(fixture.path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << fixture.path << ": could not open";
+        return 0;
+    }
+    QTextStream in(&file);
+    TriangulatedMap tmap;
+    in >> tmap;
+    sink = tmap.faces.size();
+    bytes = fixture.file_size;
+    return 1;
+}
+
+static qint64 write_map(Fixture &fixture, const TriangulatedMap &tmap, qint64 &bytes)
+{
+    QString error;
+    if (!write_triangulation(fixture.output_path, tmap, &error)) {
+        qWarning() << error;
+        return 0;
+    }
+    bytes = QFileInfo(fixture.output_path).size();
+    return 1;
+}
+
+static qint64 bench_write(Fixture &fixture, qint64 &bytes)
+{
+    return write_map(fixture, fixture.tmap_wrapper.tmap, bytes);
+}
+
+static qint64 bench_write_edited(Fixture &fixture, qint64 &bytes)
+{
+    return write_map(fixture, fixture.edited, bytes);
+}
+
+static qint64 bench_stream_write(Fixture &fixture, qint64 &bytes)
+{
+    QFile file(fixture.output_path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << fixture.output_path << ": could not open";
+        return 0;
+    }
+    {
+        QTextStream out(&file);
+        out << fixture.tmap_wrapper.tmap;
+    }
+    bytes = file.size();
+    return 1;
+}
+
+static qint64 bench_locate(Fixture &fixture, qint64 &)
+{
+    qint64 sum = 0;
+    for (int i = 0; i < fixture.n_slow_queries; i++)
+        sum += face_containing_point(fixture.tmap_wrapper.tmap, fixture.queries[i]);
+    sink = sum;
+    return fixture.n_slow_queries;
+}
+
+static qint64 bench_locate_grid(Fixture &fixture, qint64 &)
+{
+    const TMapWrapper &tmap_wrapper = fixture.tmap_wrapper;
+    qint64 sum = 0;
+    foreach(const QPointF &p, fixture.queries)
+        sum += tmap_wrapper.grid.faceContaining(tmap_wrapper.tmap, p);
+    sink = sum;
+    return fixture.queries.size();
+}
+
+static qint64 bench_locate_batch(Fixture &fixture, qint64 &)
+{
+    QVector<int> faces = locate_points(fixture.tmap_wrapper, fixture.queries);
+    sink = faces.empty() ? 0 : faces.last();
+    return fixture.queries.size();
+}
+
+static qint64 bench_nearest(Fixture &fixture, qint64 &)
+{
+    const TMapWrapper &tmap_wrapper = fixture.tmap_wrapper;
+    qreal sum = 0;
+    foreach(const QPointF &p, fixture.queries)
+        sum += tmap_wrapper.tmap.vertices[tmap_wrapper.vertex_tree.nearest(p)].x();
+    sink = qint64(sum);
+    return fixture.queries.size();
+}
+
+static qint64 bench_boundary(Fixture &fixture, qint64 &)
+{
+    qreal xmin, xmax, ymin, ymax;
+    point_set_bounds(fixture.tmap_wrapper.tmap.vertices, xmin, xmax, ymin, ymax);
+    sink = qint64(xmin + xmax + ymin + ymax);
+    return fixture.tmap_wrapper.tmap.vertices.size();
+}
+
+static qint64 bench_render(Fixture &fixture, qint64 &)
+{
+    fixture.image.fill(Qt::white);
+    RenderInfo ri = calc_render_info(fixture.tmap_wrapper, &fixture.image, 10);
+    render_map(&fixture.image, fixture.tmap_wrapper, ri, fixture.image.rect(),
+               &fixture.batches);
+    sink = fixture.image.pixel(fixture.image.width() / 2, fixture.image.height() / 2);
+    return 1;
+}
+
+struct Benchmark {
+    const char *name;
+    BenchFunction function;
+};
+
+static const Benchmark benchmarks[] = {
+    { "read", bench_read },
+    { "stream-read", bench_stream_read },
+    { "write", bench_write },
+    { "write-edited", bench_write_edited },
+    { "stream-write", bench_stream_write },
+    { "locate", bench_locate },
+    { "locate-grid", bench_locate_grid },
+    { "locate-batch", bench_locate_batch },
+    { "nearest", bench_nearest },
+    { "boundary", bench_boundary },
+    { "render", bench_render },
+};
+
+static const int n_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+static bool setup_fixture(Fixture &fixture, int n_faces, quint32 seed, QSize image_size)
+{
+    QString base = QString("%1/wte-bench-%2-%3")
+        .arg(QDir::tempPath()).arg(QCoreApplication::applicationPid()).arg(n_faces);
+    fixture.path = base + ".txt";
+    fixture.output_path = base + "-out.txt";
+
+    GeneratorOptions options;
+    options.n_faces = n_faces;
+    options.seed = seed;
+    QString error;
+    if (!generate_triangulation(fixture.path, options, &error) ||
+        !fixture.tmap_wrapper.setMap(fixture.path, &error)) {
+        qWarning() << error;
+        return false;
+    }
+    fixture.file_size = QFileInfo(fixture.path).size();
+
+    fixture.edited = fixture.tmap_wrapper.tmap;
+    fixture.edited.neighbours.clear();
+    fixture.edited.vertex_faces.clear();
+
+    fixture.batches.build(fixture.tmap_wrapper);
+    fixture.image = QImage(image_size, QImage::Format_ARGB32_Premultiplied);
+
+    // The brute force search gets about ten million face tests in all, and
+    // the indexed ones many more queries than it.
+    const TMapWrapper &tmap_wrapper = fixture.tmap_wrapper;
+    const int n_queries = 100000;
+    fixture.n_slow_queries = qBound(10, int(1e7 / qMax(1, tmap_wrapper.tmap.faces.size())), 10000);
+    Random random(seed + 1);
+    fixture.queries.reserve(n_queries);
+    for (int i = 0; i < n_queries; i++) {
+        fixture.queries.append(QPointF(tmap_wrapper.xmin + random.real() * tmap_wrapper.xrange,
+                                       tmap_wrapper.ymin + random.real() * tmap_wrapper.yrange));
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // Rendering needs a QApplication for its paint engines, but there is no
+    // need for a connection to a display.
+    QApplication app(argc, argv, false);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    QList<int> sizes;
+    sizes << 10000 << 100000 << 1000000;
+    int repeat = 5;
+    quint32 seed = 1;
+    QSize image_size(1024, 768);
+    QStringList names;
+    while (!args.empty()) {
+        QString arg = args.takeFirst();
+        if (arg == "-h" || arg == "--help") {
+            out << usage;
+            return 0;
+        }
+        bool takes_value = arg == "--sizes" || arg == "--repeat" || arg == "--seed" ||
+                           arg == "--image";
+        if (!takes_value) {
+            names << arg;
+            continue;
+        }
+        if (args.empty()) {
+            err << "wte-bench: " << arg << " needs a value\n";
+            return 2;
+        }
+
+        QString value = args.takeFirst();
+        bool ok = true;
+        if (arg == "--sizes") {
+            sizes.clear();
+            foreach(const QString &size, value.split(',')) {
+                sizes << size.toInt(&ok);
+                if (!ok || sizes.last() <= 0)
+                    break;
+            }
+        } else if (arg == "--repeat") {
+            repeat = value.toInt(&ok);
+            ok = ok && repeat > 0;
+        } else if (arg == "--seed") {
+            seed = value.toUInt(&ok);
+        } else {
+            QStringList dims = value.split('x');
+            int w = 0, h = 0;
+            ok = dims.size() == 2;
+            if (ok)
+                w = dims[0].toInt(&ok);
+            if (ok)
+                h = dims[1].toInt(&ok);
+            ok = ok && w > 0 && h > 0;
+            image_size = QSize(w, h);
+        }
+        if (!ok) {
+            err << "wte-bench: bad value for " << arg << ": " << value << "\n";
+            return 2;
+        }
+    }
+
+    QVector<const Benchmark *> selected;
+    QStringList unknown = names;
+    for (int i = 0; i < n_benchmarks; i++) {
+        if (names.empty() || names.contains(benchmarks[i].name))
+            selected.append(&benchmarks[i]);
+        unknown.removeAll(benchmarks[i].name);
+    }
+    if (!unknown.empty()) {
+        err << "wte-bench: unknown benchmark " << unknown.first() << "\n" << usage;
+        return 2;
+    }
+
+    out << "benchmark,faces,ops,best_s,median_s,ns_per_op,mb_per_s\n";
+    out.flush();
+
+    foreach(int n_faces, sizes) {
+        Fixture fixture;
+        bool ok = setup_fixture(fixture, n_faces, seed, image_size);
+        if (ok) {
+            int faces = fixture.tmap_wrapper.tmap.faces.size();
+            foreach(const Benchmark *benchmark, selected) {
+                QVector<qint64> times;
+                qint64 ops = 0, bytes = 0;
+                for (int i = 0; i < repeat; i++) {
+                    QElapsedTimer timer;
+                    timer.start();
+                    ops = benchmark->function(fixture, bytes);
+                    if (ops == 0)
+                        break;
+                    times.append(timer.nsecsElapsed());
+                }
+                if (ops == 0) {
+                    ok = false;
+                    break;
+                }
+                std::sort(times.begin(), times.end());
+
+                qint64 median = times[times.size() / 2];
+                out << benchmark->name << "," << faces << "," << ops << ","
+                    << QString::number(times.first() * 1e-9, 'g', 6) << ","
+                    << QString::number(median * 1e-9, 'g', 6) << ","
+                    << QString::number(double(median) / ops, 'f', 1) << ",";
+                if (bytes > 0)
+                    out << QString::number(bytes / (median * 1e-9) / 1e6, 'f', 2);
+                out << "\n";
+                out.flush();
+            }
+        }
+
+        QFile::remove(fixture.path);
+        QFile::remove(fixture.output_path);
+        if (!ok)
+            return 1;
+    }
+
+    return 0;
+}
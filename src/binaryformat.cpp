@@ -0,0 +1,343 @@
+#include "binaryformat.h"
+#include "perf.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QtGlobal>
+#include <cstring>
+#include <limits>
+
+static const char map_magic[8] = { 'W', 'T', 'E', 'M', 'A', 'P', '\r', '\n' };
+static const char points_magic[8] = { 'W', 'T', 'E', 'P', 'T', 'S', '\r', '\n' };
+static const quint32 format_version = 1;
+static const quint32 byte_order_mark = 0x01020304;
+static const qint64 section_alignment = 64;
+static const qint64 read_slice_size = 16 << 20;
+
+enum MapSection {
+    VerticesSection,
+    VertexFacesSection,
+    FacesSection,
+    NeighboursSection,
+    NumMapSections
+};
+
+struct Section {
+    quint64 offset;
+    quint64 count;
+};
+
+struct BinaryHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byte_order;
+    quint32 n_sections;
+    quint32 reserved;
+    Section sections[NumMapSections];
+};
+
+// The sections are copied straight to and from the arrays of the map, so
+// they have to be laid out the same on every machine writing the format.
+typedef char check_point_layout[sizeof(QPointF) == 2 * sizeof(double) ? 1 : -1];
+typedef char check_face_layout[sizeof(TriangulatedMap::Face) == 24 ? 1 : -1];
+typedef char check_neighbours_layout[sizeof(TriangulatedMap::Neighbours) == 12 ? 1 : -1];
+
+static qint64 align(qint64 offset)
+{
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+static void set_error(QString *error, const QString &path, const QString &message)
+{
+    if (error)
+        *error = QString("%1: %2").arg(path).arg(message);
+}
+
+static bool has_magic(const QString &path, const char *magic)
+{
+    QFile file(path);
+    char buf[8];
+    return file.open(QIODevice::ReadOnly) &&
+           file.read(buf, sizeof(buf)) == sizeof(buf) &&
+           memcmp(buf, magic, sizeof(buf)) == 0;
+}
+
+// Opens the file and checks its header is for this type of file and this
+// version of the format, and that each section, with elements of the given
+// sizes, lies inside the file.
+static bool open_binary(QFile &file, const char *magic, int n_sections,
+                        const qint64 *element_sizes, BinaryHeader &header, QString *error)
+{
+    QString path = file.fileName();
+    if (!file.open(QIODevice::ReadOnly)) {
+        set_error(error, path, file.errorString());
+        return false;
+    }
+
+    if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, magic, sizeof(header.magic)) != 0) {
+        set_error(error, path, "not a binary file of the expected type");
+        return false;
+    }
+    if (header.byte_order != byte_order_mark) {
+        set_error(error, path, "written on a machine with a different byte order");
+        return false;
+    }
+    if (header.version != format_version || int(header.n_sections) != n_sections) {
+        set_error(error, path, QString("unsupported format version %1").arg(header.version));
+        return false;
+    }
+
+    // Checked before anything is allocated, so a bad header can't ask for
+    // more memory than the file could fill. QVector works out the size of
+    // its buffer in an int, which must not overflow either.
+    quint64 file_size = quint64(file.size());
+    for (int i = 0; i < n_sections; i++) {
+        const Section &section = header.sections[i];
+        quint64 size = quint64(element_sizes[i]);
+        if (section.count > quint64(std::numeric_limits<int>::max() - section_alignment) / size) {
+            set_error(error, path, "too many elements");
+            return false;
+        }
+        if (section.offset > file_size || section.count > (file_size - section.offset) / size) {
+            set_error(error, path, "file is truncated");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads count elements of type T from the section straight into data. The
+// read is done in slices so progress can be reported and the load canceled
+// part way through a big section.
+template <typename T>
+static bool read_section(QFile &file, const Section &section, QVector<T> &data,
+                         Progress *progress)
+{
+    data.resize(int(section.count));
+    qint64 size = qint64(section.count) * sizeof(T);
+    if (!file.seek(section.offset))
+        return false;
+
+    char *p = reinterpret_cast<char *>(data.data());
+    for (qint64 done = 0; done < size; ) {
+        if (progress && progress->isCanceled())
+            return false;
+        qint64 slice = qMin(size - done, read_slice_size);
+        if (file.read(p + done, slice) != slice)
+            return false;
+        done += slice;
+        if (progress)
+            progress->advance(slice, file.size());
+    }
+    return true;
+}
+
+// Sets error for a failed read, which may have been canceled rather than
+// found the file too short.
+static void set_read_error(QString *error, const QString &path, Progress *progress)
+{
+    if (progress && progress->isCanceled())
+        set_error(error, path, "loading canceled");
+    else
+        set_error(error, path, "file is truncated");
+}
+
+template <typename T>
+static void layout_section(Section &section, qint64 &offset, const QVector<T> &data)
+{
+    section.offset = align(offset);
+    section.count = data.size();
+    offset = section.offset + qint64(data.size()) * sizeof(T);
+}
+
+// Pads the file with zeros up to the start of the section.
+static bool seek_section(QFile &file, const Section &section)
+{
+    if (file.pos() < qint64(section.offset)) {
+        QByteArray padding(int(section.offset - file.pos()), 0);
+        return file.write(padding) == padding.size();
+    }
+    return true;
+}
+
+template <typename T>
+static bool write_section(QFile &file, const Section &section, const QVector<T> &data)
+{
+    qint64 size = qint64(data.size()) * sizeof(T);
+    if (!seek_section(file, section))
+        return false;
+    return file.write(reinterpret_cast<const char *>(data.constData()), size) == size;
+}
+
+// Writes the faces through a zeroed buffer, so the padding between the
+// corners and the weight is the same each time the map is saved.
+static bool write_faces_section(QFile &file, const Section &section,
+                                const QVector<TriangulatedMap::Face> &faces)
+{
+    static const int slice_faces = int(read_slice_size / sizeof(TriangulatedMap::Face));
+    if (!seek_section(file, section))
+        return false;
+
+    QVector<TriangulatedMap::Face> slice(qMin(faces.size(), slice_faces));
+    memset(slice.data(), 0, slice.size() * sizeof(TriangulatedMap::Face));
+    for (int begin = 0; begin < faces.size(); begin += slice.size()) {
+        int n = qMin(faces.size() - begin, slice.size());
+        for (int i = 0; i < n; i++) {
+            const TriangulatedMap::Face &face = faces[begin + i];
+            TriangulatedMap::Face &out = slice[i];
+            out.v[0] = face.v[0];
+            out.v[1] = face.v[1];
+            out.v[2] = face.v[2];
+            out.weight = face.weight;
+        }
+        qint64 size = qint64(n) * sizeof(TriangulatedMap::Face);
+        if (file.write(reinterpret_cast<const char *>(slice.constData()), size) != size)
+            return false;
+    }
+    return true;
+}
+
+static void init_header(BinaryHeader &header, const char *magic, int n_sections)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = format_version;
+    header.byte_order = byte_order_mark;
+    header.n_sections = n_sections;
+}
+
+bool is_binary_triangulation(const QString &path)
+{
+    return has_magic(path, map_magic);
+}
+
+bool read_binary_triangulation(const QString &path, TriangulatedMap &tmap, QString *error,
+                               Progress *progress)
+{
+    PerfScope scope("read_binary_triangulation");
+    QFile file(path);
+    static const qint64 element_sizes[NumMapSections] = {
+        sizeof(QPointF), sizeof(int), sizeof(TriangulatedMap::Face),
+        sizeof(TriangulatedMap::Neighbours)
+    };
+    BinaryHeader header;
+    if (!open_binary(file, map_magic, NumMapSections, element_sizes, header, error))
+        return false;
+
+    TriangulatedMap loaded;
+    const Section *sections = header.sections;
+    if (!read_section(file, sections[VerticesSection], loaded.vertices, progress) ||
+        !read_section(file, sections[VertexFacesSection], loaded.vertex_faces, progress) ||
+        !read_section(file, sections[FacesSection], loaded.faces, progress) ||
+        !read_section(file, sections[NeighboursSection], loaded.neighbours, progress)) {
+        set_read_error(error, path, progress);
+        return false;
+    }
+
+    // Check the indices once here so the rest of the program can trust them.
+    int n_vertices = loaded.vertices.size();
+    int n_faces = loaded.faces.size();
+    bool valid = (loaded.vertex_faces.empty() || loaded.vertex_faces.size() == n_vertices) &&
+                 (loaded.neighbours.empty() || loaded.hasTopology());
+    for (int i = 0; valid && i < n_faces; i++)
+        for (int j = 0; j < 3; j++)
+            valid = valid && loaded.faces[i].v[j] >= 0 && loaded.faces[i].v[j] < n_vertices;
+    for (int i = 0; valid && i < loaded.neighbours.size(); i++)
+        for (int j = 0; j < 3; j++)
+            valid = valid && loaded.neighbours[i].f[j] >= -1 && loaded.neighbours[i].f[j] < n_faces;
+    for (int i = 0; valid && i < loaded.vertex_faces.size(); i++)
+        valid = loaded.vertex_faces[i] >= -1 && loaded.vertex_faces[i] < n_faces;
+    if (!valid) {
+        set_error(error, path, "index out of range");
+        return false;
+    }
+
+    tmap = loaded;
+    perf_count("bytes_read", file.size());
+    perf_count("faces_read", tmap.faces.size());
+    return true;
+}
+
+bool write_binary_triangulation(const QString &path, const TriangulatedMap &tmap, QString *error)
+{
+    PerfScope scope("write_binary_triangulation");
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        set_error(error, path, file.errorString());
+        return false;
+    }
+
+    // A map without adjacency is written without the neighbours section, and
+    // comes back without it too.
+    QVector<int> vertex_faces = tmap.vertex_faces;
+    if (vertex_faces.size() != tmap.vertices.size())
+        vertex_faces.fill(-1, tmap.vertices.size());
+    QVector<TriangulatedMap::Neighbours> no_neighbours;
+    const QVector<TriangulatedMap::Neighbours> &neighbours =
+        tmap.hasTopology() ? tmap.neighbours : no_neighbours;
+
+    BinaryHeader header;
+    init_header(header, map_magic, NumMapSections);
+    Section *sections = header.sections;
+    qint64 offset = sizeof(header);
+    layout_section(sections[VerticesSection], offset, tmap.vertices);
+    layout_section(sections[VertexFacesSection], offset, vertex_faces);
+    layout_section(sections[FacesSection], offset, tmap.faces);
+    layout_section(sections[NeighboursSection], offset, neighbours);
+
+    if (file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header) ||
+        !write_section(file, sections[VerticesSection], tmap.vertices) ||
+        !write_section(file, sections[VertexFacesSection], vertex_faces) ||
+        !write_faces_section(file, sections[FacesSection], tmap.faces) ||
+        !write_section(file, sections[NeighboursSection], neighbours)) {
+        set_error(error, path, file.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool is_binary_point_set(const QString &path)
+{
+    return has_magic(path, points_magic);
+}
+
+bool read_binary_point_set(const QString &path, QVector<QPointF> &points, QString *error,
+                           Progress *progress)
+{
+    QFile file(path);
+    static const qint64 element_sizes[1] = { sizeof(QPointF) };
+    BinaryHeader header;
+    if (!open_binary(file, points_magic, 1, element_sizes, header, error))
+        return false;
+
+    QVector<QPointF> loaded;
+    if (!read_section(file, header.sections[0], loaded, progress)) {
+        set_read_error(error, path, progress);
+        return false;
+    }
+
+    points = loaded;
+    return true;
+}
+
+bool write_binary_point_set(const QString &path, const QVector<QPointF> &points, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        set_error(error, path, file.errorString());
+        return false;
+    }
+
+    BinaryHeader header;
+    init_header(header, points_magic, 1);
+    qint64 offset = sizeof(header);
+    layout_section(header.sections[0], offset, points);
+
+    if (file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header) ||
+        !write_section(file, header.sections[0], points)) {
+        set_error(error, path, file.errorString());
+        return false;
+    }
+    return true;
+}
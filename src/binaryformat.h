@@ -0,0 +1,31 @@
+#pragma once
+
+#include "triangulatedmap.h"
+#include "progress.h"
+
+#include <QPointF>
+#include <QString>
+#include <QVector>
+
+// Binary files for weighted triangulations (.wtb) and point sets (.wpb).
+//
+// A file is a fixed size header followed by sections holding the arrays of
+// the map exactly as they are laid out in memory, each starting on a 64 byte
+// boundary. Loading is then a bulk read of each section into place, with no
+// parsing. Unlike the text format, a map is stored after the dummy and
+// zero-area faces have been dropped, with -1 for boundary neighbours.
+//
+// The readers report progress within the caller's current stage, and give
+// up if the progress is canceled.
+
+bool is_binary_triangulation(const QString &path);
+bool read_binary_triangulation(const QString &path, TriangulatedMap &tmap,
+                               QString *error = 0, Progress *progress = 0);
+bool write_binary_triangulation(const QString &path, const TriangulatedMap &tmap,
+                                QString *error = 0);
+
+bool is_binary_point_set(const QString &path);
+bool read_binary_point_set(const QString &path, QVector<QPointF> &points,
+                           QString *error = 0, Progress *progress = 0);
+bool write_binary_point_set(const QString &path, const QVector<QPointF> &points,
+                            QString *error = 0);
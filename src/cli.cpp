@@ -0,0 +1,323 @@
+#include <QtGui>
+#include <QtConcurrentMap>
+
+#include "tmapwrapper.h"
+#include "maprenderer.h"
+#include "vectorwriter.h"
+#include "generator.h"
+#include "perf.h"
+
+#include <cstdio>
+
+// Command line front end to the map loader, writer, renderer and generator,
+// for processing batches of maps without the editor.
+
+static const char usage[] =
+    "Usage: wte-cli COMMAND [OPTIONS] FILE...\n"
+    "\n"
+    "Commands:\n"
+    "  stats             Print statistics about each map\n"
+    "  convert           Convert each map to another format\n"
+    "  render            Render each map to a figure\n"
+    "  generate          Generate a synthetic map into each FILE, in the text\n"
+    "                    format\n"
+    "\n"
+    "Options:\n"
+    "  --to FORMAT       Format to convert to: txt or wtb (default: wtb)\n"
+    "  --format FORMAT   Format to render to: eps, svg, pdf, or any image\n"
+    "                    format such as png or tiff (default: eps)\n"
+    "  --size N          Longest side of rendered images in pixels\n"
+    "                    (default: 2000)\n"
+    "  --dissolve        Draw connected faces of equal weight as one region\n"
+    "                    in vector figures\n"
+    "  --precision N     Decimal places of coordinates in vector figures\n"
+    "                    (default: 2)\n"
+    "  --no-outlines     Leave out outlines in vector figures\n"
+    "  -o, --output DIR  Write output files to DIR instead of next to their\n"
+    "                    input\n"
+    "  -j, --jobs N      Process N files at a time (default: one per core)\n"
+    "  --timings FILE    Write how long loading, rendering and so on took,\n"
+    "                    as JSON\n"
+    "  --trace FILE      Write the same as a trace for chrome://tracing\n"
+    "\n"
+    "Generate options:\n"
+    "  --faces N         Number of faces (default: 100000)\n"
+    "  --layout LAYOUT   grid, random or clustered (default: grid)\n"
+    "  --clusters N      Number of clusters in the clustered layout\n"
+    "                    (default: 8)\n"
+    "  --weights FIELD   uniform, gradient, patches, noise or random\n"
+    "                    (default: patches)\n"
+    "  --levels N        Number of different weights, or 0 for any\n"
+    "                    (default: 10)\n"
+    "  --max-weight W    Largest weight (default: 10)\n"
+    "  --feature-size F  Size of weight patches and noise, as a fraction of\n"
+    "                    the width of the map (default: 0.05)\n"
+    "  --seed N          Seed of the first map, one more for each after it\n"
+    "                    (default: 1)\n";
+
+struct Options {
+    QString command;
+    QString format;
+    QString output_dir;
+    QString timings_path;
+    QString trace_path;
+    int size;
+    VectorOptions vector_options;
+    GeneratorOptions generator_options;
+};
+
+// One input file, and what came of processing it.
+struct Job {
+    const Options *options;
+    QString path;
+    bool ok;
+    QStringList output;
+};
+
+static QString output_path(const Options &options, const QString &path, const QString &format)
+{
+    QFileInfo info(path);
+    QString dir = options.output_dir.isEmpty() ? info.dir().path() : options.output_dir;
+    return dir + "/" + info.completeBaseName() + "." + format;
+}
+
+static bool write_perf_files(const Options &options, QTextStream &err)
+{
+    QString error;
+    if ((!options.timings_path.isEmpty() && !write_perf_json(options.timings_path, &error)) ||
+        (!options.trace_path.isEmpty() && !write_perf_trace(options.trace_path, &error))) {
+        err << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+static bool parse_layout(const QString &name, GeneratorOptions::Layout &layout)
+{
+    if (name == "grid")
+        layout = GeneratorOptions::Grid;
+    else if (name == "random")
+        layout = GeneratorOptions::Random;
+    else if (name == "clustered")
+        layout = GeneratorOptions::Clustered;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_weight_field(const QString &name, GeneratorOptions::WeightField &weights)
+{
+    if (name == "uniform")
+        weights = GeneratorOptions::Uniform;
+    else if (name == "gradient")
+        weights = GeneratorOptions::Gradient;
+    else if (name == "patches")
+        weights = GeneratorOptions::Patches;
+    else if (name == "noise")
+        weights = GeneratorOptions::Noise;
+    else if (name == "random")
+        weights = GeneratorOptions::RandomWeights;
+    else
+        return false;
+    return true;
+}
+
+static void run_job(Job &job)
+{
+    const Options &options = *job.options;
+    job.ok = false;
+
+    TMapWrapper tmap_wrapper;
+    QString error;
+    if (!tmap_wrapper.setMap(job.path, &error)) {
+        job.output << error;
+        return;
+    }
+
+    if (options.command == "stats") {
+        job.output << tmap_wrapper.stats();
+        job.ok = true;
+    } else if (options.command == "convert") {
+        QString path = output_path(options, job.path, options.format);
+        if (QFileInfo(path).absoluteFilePath() == QFileInfo(job.path).absoluteFilePath()) {
+            job.output << QString("%1: would overwrite the input").arg(path);
+        } else if (!tmap_wrapper.save(path, &error)) {
+            job.output << error;
+        } else {
+            job.output << QString("wrote %1").arg(path);
+            job.ok = true;
+        }
+    } else if (options.command == "render") {
+        QString path = output_path(options, job.path, options.format);
+        if (is_vector_format(path)) {
+            job.ok = write_vector(path, tmap_wrapper, options.vector_options, &error);
+        } else {
+            job.ok = render_image(path, tmap_wrapper, options.size);
+            error = QString("%1: could not render").arg(path);
+        }
+        if (job.ok)
+            job.output << QString("wrote %1").arg(path);
+        else
+            job.output << error;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // The renderer needs a QApplication for its paint engines, but there is
+    // no need for a connection to a display.
+    QApplication app(argc, argv, false);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    if (args.empty() || args.first() == "-h" || args.first() == "--help") {
+        out << usage;
+        return args.empty() ? 2 : 0;
+    }
+
+    Options options;
+    options.command = args.takeFirst();
+    options.size = 2000;
+    if (options.command == "convert")
+        options.format = "wtb";
+    else if (options.command == "render")
+        options.format = "eps";
+    else if (options.command != "stats" && options.command != "generate") {
+        err << "wte-cli: unknown command " << options.command << "\n" << usage;
+        return 2;
+    }
+
+    QStringList paths;
+    int jobs = QThread::idealThreadCount();
+    while (!args.empty()) {
+        QString arg = args.takeFirst();
+        if (arg == "--dissolve") {
+            options.vector_options.dissolve = true;
+            continue;
+        }
+        if (arg == "--no-outlines") {
+            options.vector_options.outlines = false;
+            continue;
+        }
+        bool takes_value = arg == "--to" || arg == "--format" || arg == "--size" ||
+                           arg == "--precision" ||
+                           arg == "-o" || arg == "--output" || arg == "-j" || arg == "--jobs" ||
+                           arg == "--faces" || arg == "--layout" || arg == "--clusters" ||
+                           arg == "--weights" || arg == "--levels" || arg == "--max-weight" ||
+                           arg == "--feature-size" || arg == "--seed" ||
+                           arg == "--timings" || arg == "--trace";
+        if (!takes_value) {
+            paths << arg;
+            continue;
+        }
+        if (args.empty()) {
+            err << "wte-cli: " << arg << " needs a value\n";
+            return 2;
+        }
+
+        QString value = args.takeFirst();
+        bool ok = true;
+        GeneratorOptions &generator_options = options.generator_options;
+        if (arg == "--faces")
+            generator_options.n_faces = value.toInt(&ok);
+        else if (arg == "--layout")
+            ok = parse_layout(value, generator_options.layout);
+        else if (arg == "--clusters")
+            generator_options.n_clusters = value.toInt(&ok);
+        else if (arg == "--weights")
+            ok = parse_weight_field(value, generator_options.weights);
+        else if (arg == "--levels")
+            generator_options.levels = value.toInt(&ok);
+        else if (arg == "--max-weight")
+            generator_options.max_weight = value.toDouble(&ok);
+        else if (arg == "--feature-size")
+            generator_options.feature_size = value.toDouble(&ok);
+        else if (arg == "--seed")
+            generator_options.seed = value.toUInt(&ok);
+        else if (arg == "--to" || arg == "--format")
+            options.format = value.toLower();
+        else if (arg == "--size")
+            options.size = value.toInt(&ok);
+        else if (arg == "--precision")
+            options.vector_options.precision = value.toInt(&ok);
+        else if (arg == "-o" || arg == "--output")
+            options.output_dir = value;
+        else if (arg == "--timings")
+            options.timings_path = value;
+        else if (arg == "--trace")
+            options.trace_path = value;
+        else
+            jobs = value.toInt(&ok);
+        if (!ok || options.size <= 0 || jobs <= 0 || options.vector_options.precision < 0 ||
+            generator_options.n_faces < 2 || generator_options.n_clusters < 0 ||
+            generator_options.levels < 0 || !(generator_options.max_weight > 0) ||
+            !(generator_options.feature_size > 0)) {
+            err << "wte-cli: bad value for " << arg << ": " << value << "\n";
+            return 2;
+        }
+    }
+
+    if (options.command == "convert" && options.format != "txt" && options.format != "wtb") {
+        err << "wte-cli: can only convert to txt or wtb\n";
+        return 2;
+    }
+    if (paths.empty()) {
+        err << "wte-cli: no input files\n";
+        return 2;
+    }
+    if (!options.output_dir.isEmpty())
+        QDir().mkpath(options.output_dir);
+
+    // The generator already runs in parallel, so maps are made one by one.
+    if (options.command == "generate") {
+        GeneratorOptions generator_options = options.generator_options;
+        int n_failed = 0;
+        foreach(const QString &path, paths) {
+            QString output = options.output_dir.isEmpty()
+                ? path : options.output_dir + "/" + QFileInfo(path).fileName();
+            QString error;
+            if (output.endsWith(".wtb")) {
+                err << output << ": can only generate text maps\n";
+                n_failed++;
+            } else if (!generate_triangulation(output, generator_options, &error)) {
+                err << error << "\n";
+                n_failed++;
+            } else {
+                out << "wrote " << output << "\n";
+            }
+            generator_options.seed++;
+        }
+        if (!write_perf_files(options, err))
+            n_failed++;
+        return n_failed == 0 ? 0 : 1;
+    }
+
+    QVector<Job> batch;
+    foreach(const QString &path, paths) {
+        Job job;
+        job.options = &options;
+        job.path = path;
+        job.ok = false;
+        batch.append(job);
+    }
+
+    QThreadPool::globalInstance()->setMaxThreadCount(jobs);
+    QtConcurrent::blockingMap(batch, run_job);
+
+    int n_failed = 0;
+    foreach(const Job &job, batch) {
+        QTextStream &stream = job.ok ? out : err;
+        if (options.command == "stats" && job.ok)
+            stream << job.path << ":\n";
+        foreach(const QString &line, job.output)
+            stream << (options.command == "stats" && job.ok ? "  " : "") << line << "\n";
+        if (!job.ok)
+            n_failed++;
+    }
+    if (!write_perf_files(options, err))
+        n_failed++;
+
+    return n_failed == 0 ? 0 : 1;
+}
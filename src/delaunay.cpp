@@ -0,0 +1,657 @@
+#include "delaunay.h"
+#include "predicates.h"
+
+#include <QHash>
+#include <QPair>
+#include <QRectF>
+#include <QtAlgorithms>
+#include <QtConcurrentMap>
+#include <limits>
+
+static const int chunk_size = 65536;
+
+// The distance of (x, y) along a Hilbert curve through a 65536 x 65536 grid.
+static quint32 hilbert_index(quint32 x, quint32 y)
+{
+    quint32 d = 0;
+    for (quint32 s = 1 << 15; s > 0; s >>= 1) {
+        quint32 rx = (x & s) ? 1 : 0;
+        quint32 ry = (y & s) ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = 0xffff - x;
+                y = 0xffff - y;
+            }
+            qSwap(x, y);
+        }
+    }
+    return d;
+}
+
+struct HilbertChunk {
+    const QVector<QPointF> *points;
+    QRectF bounds;
+    QPair<quint32, int> *keys;
+    int begin, end;
+};
+
+static void hilbert_keys(HilbertChunk &chunk)
+{
+    qreal sx = 0xffff / qMax(chunk.bounds.width(), std::numeric_limits<qreal>::min());
+    qreal sy = 0xffff / qMax(chunk.bounds.height(), std::numeric_limits<qreal>::min());
+    for (int i = chunk.begin; i < chunk.end; i++) {
+        const QPointF &p = (*chunk.points)[i];
+        quint32 x = quint32((p.x() - chunk.bounds.left()) * sx);
+        quint32 y = quint32((p.y() - chunk.bounds.top()) * sy);
+        chunk.keys[i] = qMakePair(hilbert_index(x, y), i);
+    }
+}
+
+// The points in the order they are inserted: along a Hilbert curve, so that
+// each point is close to the one before and the walk to find it is short.
+static QVector<int> insertion_order(const QVector<QPointF> &points)
+{
+    int n = points.size();
+    QRectF bounds(points[0], points[0]);
+    foreach(const QPointF &p, points) {
+        bounds.setLeft(qMin(bounds.left(), p.x()));
+        bounds.setRight(qMax(bounds.right(), p.x()));
+        bounds.setTop(qMin(bounds.top(), p.y()));
+        bounds.setBottom(qMax(bounds.bottom(), p.y()));
+    }
+
+    QVector<QPair<quint32, int> > keys(n);
+    QVector<HilbertChunk> chunks;
+    for (int begin = 0; begin < n; begin += chunk_size) {
+        HilbertChunk chunk;
+        chunk.points = &points;
+        chunk.bounds = bounds;
+        chunk.keys = keys.data();
+        chunk.begin = begin;
+        chunk.end = qMin(n, begin + chunk_size);
+        chunks.append(chunk);
+    }
+    if (chunks.size() == 1)
+        hilbert_keys(chunks[0]);
+    else
+        QtConcurrent::blockingMap(chunks, hilbert_keys);
+    qSort(keys);
+
+    QVector<int> order(n);
+    for (int i = 0; i < n; i++)
+        order[i] = keys[i].second;
+    return order;
+}
+
+DelaunayTriangulation::DelaunayTriangulation()
+{
+    points = 0;
+    clear();
+}
+
+void DelaunayTriangulation::clear()
+{
+    tris.clear();
+    free_tris.clear();
+    n_faces = 0;
+    last = -1;
+    vertex_tri.clear();
+    waiting.clear();
+    mark.clear();
+    stamp = 0;
+    fan_start.clear();
+    ghost_fan_start = -1;
+}
+
+void DelaunayTriangulation::build(const QVector<QPointF> *points)
+{
+    clear();
+    this->points = points;
+    if (points->empty())
+        return;
+
+    grow_arrays();
+    waiting = insertion_order(*points);
+    try_start();
+}
+
+void DelaunayTriangulation::grow_arrays()
+{
+    int n = points->size();
+    if (vertex_tri.size() < n) {
+        int old = vertex_tri.size();
+        vertex_tri.resize(n);
+        fan_start.resize(n);
+        for (int i = old; i < n; i++)
+            vertex_tri[i] = fan_start[i] = -1;
+    }
+}
+
+bool DelaunayTriangulation::is_ghost(int t) const
+{
+    const Tri &tri = tris[t];
+    return tri.v[0] == ghost || tri.v[1] == ghost || tri.v[2] == ghost;
+}
+
+// Whether p is inside the triangle's circumcircle. A point is inside a ghost
+// triangle's circle if it is outside its hull edge, or on the edge itself.
+bool DelaunayTriangulation::in_circle(int t, const QPointF &p) const
+{
+    const Tri &tri = tris[t];
+    for (int j = 0; j < 3; j++) {
+        if (tri.v[j] != ghost)
+            continue;
+
+        const QPointF &a = point(tri.v[(j + 1) % 3]);
+        const QPointF &b = point(tri.v[(j + 2) % 3]);
+        qreal side = orient2d(a, b, p);
+        if (side != 0)
+            return side > 0;
+        // p is on the line through the edge, so it is on the edge if it is
+        // between the ends in x, or in y if the edge is upright.
+        if (a.x() != b.x())
+            return qMin(a.x(), b.x()) < p.x() && p.x() < qMax(a.x(), b.x());
+        return qMin(a.y(), b.y()) < p.y() && p.y() < qMax(a.y(), b.y());
+    }
+    return incircle(point(tri.v[0]), point(tri.v[1]), point(tri.v[2]), p) > 0;
+}
+
+// Walks from start towards p, returning the triangle p is in or on, or a
+// ghost triangle if p is outside the hull.
+int DelaunayTriangulation::locate(const QPointF &p, int start) const
+{
+    int t = start;
+    if (t < 0 || t >= tris.size() || tris[t].v[0] == dead)
+        t = last;
+    for (int j = 0; j < 3; j++) {
+        if (tris[t].v[j] == ghost)
+            t = tris[t].n[j];
+    }
+
+    unsigned int rotate = 0;
+    for (int step = 0; step < tris.size(); step++) {
+        if (is_ghost(t))
+            return t;
+
+        const Tri &tri = tris[t];
+        int next = -1;
+        rotate = rotate * 1103515245u + 12345u;
+        for (int k = 0; k < 3; k++) {
+            int j = (k + (rotate >> 16)) % 3;
+            if (orient2d(point(tri.v[(j + 1) % 3]), point(tri.v[(j + 2) % 3]), p) < 0) {
+                next = tri.n[j];
+                break;
+            }
+        }
+        if (next == -1)
+            return t;
+        t = next;
+    }
+
+    // Rounding sent the walk in circles, so look at every triangle.
+    for (t = 0; t < tris.size(); t++) {
+        if (tris[t].v[0] != dead && in_circle(t, p))
+            return t;
+    }
+    return -1;
+}
+
+int &DelaunayTriangulation::fan_slot(int v)
+{
+    return v == ghost ? ghost_fan_start : fan_start[v];
+}
+
+int DelaunayTriangulation::new_tri(int a, int b, int c)
+{
+    int t;
+    if (free_tris.empty()) {
+        t = tris.size();
+        tris.resize(t + 1);
+        mark.append(0);
+    } else {
+        t = free_tris.last();
+        free_tris.resize(free_tris.size() - 1);
+    }
+
+    Tri &tri = tris[t];
+    tri.v[0] = a;
+    tri.v[1] = b;
+    tri.v[2] = c;
+    tri.n[0] = tri.n[1] = tri.n[2] = -1;
+    for (int j = 0; j < 3; j++) {
+        if (tri.v[j] != ghost)
+            vertex_tri[tri.v[j]] = t;
+    }
+    if (!is_ghost(t))
+        n_faces++;
+    fan_slot(a) = t;
+    return t;
+}
+
+void DelaunayTriangulation::free_tri(int t)
+{
+    if (!is_ghost(t))
+        n_faces--;
+    tris[t].v[0] = dead;
+    free_tris.append(t);
+}
+
+// Joins up triangles sharing their third corner, each starting at a
+// different vertex, across the edges to that corner. The triangle across
+// from the first corner of (a, b, c) is the one starting at b.
+void DelaunayTriangulation::link_fan(const QVector<int> &fan)
+{
+    foreach(int t, fan) {
+        int s = fan_slot(tris[t].v[1]);
+        tris[t].n[0] = s;
+        tris[s].n[1] = t;
+    }
+}
+
+// Starts the triangulation from the first three waiting points that make a
+// triangle, if there are any, and inserts the rest after them.
+void DelaunayTriangulation::try_start()
+{
+    int a = -1, b = -1, c = -1;
+    foreach(int i, waiting) {
+        const QPointF &p = point(i);
+        if (a == -1) {
+            a = i;
+        } else if (b == -1) {
+            if (p != point(a))
+                b = i;
+        } else if (orient2d(point(a), point(b), p) != 0) {
+            c = i;
+            break;
+        }
+    }
+    if (c == -1)
+        return;
+
+    start(a, b, c);
+    QVector<int> rest = waiting;
+    waiting.clear();
+    foreach(int i, rest) {
+        if (i != a && i != b && i != c && !insert_point(i, last))
+            waiting.append(i);
+    }
+}
+
+void DelaunayTriangulation::start(int a, int b, int c)
+{
+    if (orient2d(point(a), point(b), point(c)) < 0)
+        qSwap(b, c);
+
+    int t = new_tri(a, b, c);
+    fan.clear();
+    for (int j = 0; j < 3; j++) {
+        int g = new_tri(tris[t].v[(j + 2) % 3], tris[t].v[(j + 1) % 3], ghost);
+        tris[t].n[j] = g;
+        tris[g].n[2] = t;
+        fan.append(g);
+    }
+    link_fan(fan);
+    last = t;
+}
+
+// Bowyer-Watson insertion: removes the triangles whose circumcircles the
+// point is inside, found by spreading out from the triangle it lands in,
+// and joins the point to the edges of the hole they leave. Returns false,
+// leaving the triangulation as it was, if the point is already there.
+bool DelaunayTriangulation::insert_point(int point_idx, int start)
+{
+    const QPointF &p = point(point_idx);
+    int seed = locate(p, start);
+    if (seed == -1)
+        return false;
+    for (int j = 0; j < 3; j++) {
+        int v = tris[seed].v[j];
+        if (v != ghost && point(v) == p)
+            return false;
+    }
+
+    // The hole is every triangle whose circle p is inside that can be
+    // reached from the one p is in.
+    stamp++;
+    hole.clear();
+    hole.append(seed);
+    mark[seed] = stamp;
+    for (int i = 0; i < hole.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int u = tris[hole[i]].n[j];
+            if (mark[u] != stamp && in_circle(u, p)) {
+                mark[u] = stamp;
+                hole.append(u);
+            }
+        }
+    }
+
+    // p has to see every edge of the hole from inside, or the new triangles
+    // would overlap. Rounding can leave out a triangle p is right on the
+    // edge of, so take in the triangle beyond any edge p doesn't see.
+    for (int i = 0; i < hole.size(); i++) {
+        const Tri &tri = tris[hole[i]];
+        for (int j = 0; j < 3; j++) {
+            int u = tri.n[j];
+            int a = tri.v[(j + 1) % 3], b = tri.v[(j + 2) % 3];
+            if (mark[u] != stamp && a != ghost && b != ghost &&
+                orient2d(point(a), point(b), p) <= 0) {
+                mark[u] = stamp;
+                hole.append(u);
+            }
+        }
+    }
+
+    // The edges around the hole, each with the triangle outside it.
+    hole_edges.clear();
+    foreach(int t, hole) {
+        const Tri &tri = tris[t];
+        for (int j = 0; j < 3; j++) {
+            int u = tri.n[j];
+            if (mark[u] != stamp) {
+                hole_edges.append(tri.v[(j + 1) % 3]);
+                hole_edges.append(tri.v[(j + 2) % 3]);
+                hole_edges.append(u);
+            }
+        }
+    }
+
+    foreach(int t, hole)
+        free_tri(t);
+
+    fan.clear();
+    for (int i = 0; i < hole_edges.size(); i += 3) {
+        int t = new_tri(hole_edges[i], hole_edges[i + 1], point_idx);
+        int u = hole_edges[i + 2];
+        tris[t].n[2] = u;
+        for (int k = 0; k < 3; k++) {
+            if (tris[u].v[(k + 2) % 3] == hole_edges[i])
+                tris[u].n[k] = t;
+        }
+        fan.append(t);
+        if (!is_ghost(t))
+            last = t;
+    }
+    link_fan(fan);
+    return true;
+}
+
+void DelaunayTriangulation::insert(int point_idx, int near)
+{
+    grow_arrays();
+    if (tris.empty()) {
+        waiting.append(point_idx);
+        try_start();
+        return;
+    }
+
+    int start = last;
+    if (near >= 0 && near < vertex_tri.size() && vertex_tri[near] != -1)
+        start = vertex_tri[near];
+    if (!insert_point(point_idx, start))
+        waiting.append(point_idx);
+}
+
+void DelaunayTriangulation::remove(int v)
+{
+    if (v >= vertex_tri.size() || vertex_tri[v] == -1) {
+        int i = waiting.indexOf(v);
+        if (i != -1)
+            waiting.remove(i);
+        return;
+    }
+
+    // The triangles around v, anticlockwise. Each has an edge a -> b
+    // opposite v, with v on its left and the triangle outer beyond it.
+    QVector<int> star, link_a, link_b, outer;
+    int t = vertex_tri[v];
+    do {
+        const Tri &tri = tris[t];
+        int j = tri.v[0] == v ? 0 : tri.v[1] == v ? 1 : 2;
+        star.append(t);
+        link_a.append(tri.v[(j + 1) % 3]);
+        link_b.append(tri.v[(j + 2) % 3]);
+        outer.append(tri.n[j]);
+        t = tri.n[(j + 1) % 3];
+    } while (t != vertex_tri[v]);
+
+    // The polygon the triangles leave is filled with the triangles of the
+    // Delaunay triangulation of its corners that are on v's side of its
+    // edges, found by spreading out from the edges. Where that meets the
+    // hull of the corners, v was on the hull and the hull edge takes its
+    // place. Any polygon edge with nothing on v's side joins the hull too.
+    QVector<QPointF> corners;
+    QVector<int> corner_ids;
+    QHash<int, int> local_id;
+    foreach(int a, link_a) {
+        if (a != ghost) {
+            local_id.insert(a, corners.size());
+            corners.append(point(a));
+            corner_ids.append(a);
+        }
+    }
+    DelaunayTriangulation local;
+    local.build(&corners);
+
+    QHash<QPair<int, int>, int> polygon_edges;
+    for (int i = 0; i < star.size(); i++) {
+        if (link_a[i] != ghost && link_b[i] != ghost)
+            polygon_edges.insert(qMakePair(local_id[link_a[i]], local_id[link_b[i]]), i);
+    }
+
+    QVector<int> new_corners;
+    QVector<bool> taken(local.tris.size(), false);
+    QVector<int> stack;
+    bool ok = true;
+    QHash<QPair<int, int>, int>::const_iterator it;
+    for (it = polygon_edges.constBegin(); it != polygon_edges.constEnd() && ok; ++it) {
+        int la = it.key().first, lb = it.key().second;
+        if (local.n_faces == 0) {
+            new_corners << corner_ids[la] << corner_ids[lb] << ghost;
+            continue;
+        }
+
+        // The local triangle with the edge la -> b, found by going round la.
+        int lt = -1, start_t = local.vertex_tri[la], s = start_t;
+        do {
+            const Tri &tri = local.tris[s];
+            int j = tri.v[0] == la ? 0 : tri.v[1] == la ? 1 : 2;
+            if (tri.v[(j + 1) % 3] == lb) {
+                lt = s;
+                break;
+            }
+            s = tri.n[(j + 1) % 3];
+        } while (s != start_t);
+
+        if (lt == -1)
+            ok = false;
+        else if (local.is_ghost(lt))
+            new_corners << corner_ids[la] << corner_ids[lb] << ghost;
+        else if (!taken[lt]) {
+            taken[lt] = true;
+            stack.append(lt);
+        }
+    }
+    while (ok && !stack.empty()) {
+        int lt = stack.last();
+        stack.resize(stack.size() - 1);
+        const Tri &tri = local.tris[lt];
+        new_corners << corner_ids[tri.v[0]] << corner_ids[tri.v[1]] << corner_ids[tri.v[2]];
+        for (int k = 0; k < 3; k++) {
+            int la = tri.v[(k + 1) % 3], lb = tri.v[(k + 2) % 3];
+            int u = tri.n[k];
+            if (polygon_edges.contains(qMakePair(la, lb)))
+                continue;
+            if (local.is_ghost(u))
+                new_corners << corner_ids[lb] << corner_ids[la] << ghost;
+            else if (!taken[u]) {
+                taken[u] = true;
+                stack.append(u);
+            }
+        }
+    }
+
+    vertex_tri[v] = -1;
+    if (!ok) {
+        // Points on a circle can make the corners' triangulation cross an
+        // edge of the polygon. Start again without v instead.
+        restart();
+        return;
+    }
+
+    foreach(int s, star)
+        free_tri(s);
+
+    // Join the new triangles to each other and to the triangles around the
+    // polygon by matching up their edges.
+    QHash<QPair<int, int>, int> edge_tri;
+    foreach(int o, outer) {
+        for (int k = 0; k < 3; k++)
+            edge_tri.insert(qMakePair(tris[o].v[(k + 1) % 3], tris[o].v[(k + 2) % 3]), 3 * o + k);
+    }
+    QVector<int> made;
+    for (int i = 0; i < new_corners.size(); i += 3) {
+        int nt = new_tri(new_corners[i], new_corners[i + 1], new_corners[i + 2]);
+        made.append(nt);
+        for (int k = 0; k < 3; k++)
+            edge_tri.insert(qMakePair(tris[nt].v[(k + 1) % 3], tris[nt].v[(k + 2) % 3]), 3 * nt + k);
+        if (!is_ghost(nt))
+            last = nt;
+    }
+    foreach(int nt, made) {
+        for (int k = 0; k < 3; k++) {
+            int twin = edge_tri.value(qMakePair(tris[nt].v[(k + 2) % 3], tris[nt].v[(k + 1) % 3]), -1);
+            Q_ASSERT(twin != -1);
+            tris[nt].n[k] = twin / 3;
+            tris[twin / 3].n[twin % 3] = nt;
+        }
+    }
+    if (tris[last].v[0] == dead && !made.empty())
+        last = made.first();
+
+    if (n_faces == 0) {
+        restart();
+        return;
+    }
+
+    // A point that was waiting on top of v can take its place.
+    QPointF removed = point(v);
+    for (int i = 0; i < waiting.size(); i++) {
+        if (point(waiting[i]) == removed && insert_point(waiting[i], last)) {
+            waiting.remove(i);
+            break;
+        }
+    }
+}
+
+// Throws the triangles away and starts again from the points, for when
+// removing a point leaves too little to triangulate or a corner case the
+// local repair can't handle.
+void DelaunayTriangulation::restart()
+{
+    QVector<int> in;
+    for (int v = 0; v < vertex_tri.size(); v++) {
+        if (vertex_tri[v] != -1)
+            in.append(v);
+    }
+    in += waiting;
+
+    tris.clear();
+    free_tris.clear();
+    mark.clear();
+    n_faces = 0;
+    last = -1;
+    vertex_tri.fill(-1);
+    waiting.clear();
+    foreach(int v, in) {
+        if (v < points->size())
+            waiting.append(v);
+    }
+    try_start();
+}
+
+void DelaunayTriangulation::relabel(int from, int to)
+{
+    if (from == to)
+        return;
+
+    grow_arrays();
+    int i = waiting.indexOf(from);
+    if (i != -1)
+        waiting[i] = to;
+    if (from >= vertex_tri.size() || vertex_tri[from] == -1)
+        return;
+
+    int start = vertex_tri[from], t = start;
+    do {
+        Tri &tri = tris[t];
+        int j = tri.v[0] == from ? 0 : tri.v[1] == from ? 1 : 2;
+        tri.v[j] = to;
+        t = tri.n[(j + 1) % 3];
+    } while (t != start);
+    vertex_tri[to] = start;
+    vertex_tri[from] = -1;
+}
+
+void DelaunayTriangulation::edges(QVector<QLineF> &lines) const
+{
+    for (int t = 0; t < tris.size(); t++) {
+        if (tris[t].v[0] == dead || is_ghost(t))
+            continue;
+        for (int k = 0; k < 3; k++) {
+            int u = tris[t].n[k];
+            if (u > t || is_ghost(u))
+                lines.append(QLineF(point(tris[t].v[(k + 1) % 3]), point(tris[t].v[(k + 2) % 3])));
+        }
+    }
+}
+
+bool DelaunayTriangulation::toMap(TriangulatedMap &tmap, QString *error) const
+{
+    if (n_faces == 0) {
+        if (error) {
+            *error = points && points->size() >= 3
+                ? "The points are all in a line, so there is nothing to triangulate"
+                : "Need at least three points to triangulate";
+        }
+        return false;
+    }
+
+    QVector<int> face_idx(tris.size(), -1);
+    int n = 0;
+    for (int t = 0; t < tris.size(); t++) {
+        if (tris[t].v[0] != dead && !is_ghost(t))
+            face_idx[t] = n++;
+    }
+
+    tmap = TriangulatedMap();
+    tmap.vertices.reserve(points->size() + 1);
+    tmap.vertices.append(QPointF(0, 0));
+    tmap.vertices += *points;
+    tmap.vertex_faces.fill(-1, points->size() + 1);
+    tmap.faces.resize(n);
+    tmap.neighbours.resize(n);
+    for (int t = 0; t < tris.size(); t++) {
+        int i = face_idx[t];
+        if (i == -1)
+            continue;
+
+        TriangulatedMap::Face &face = tmap.faces[i];
+        for (int j = 0; j < 3; j++) {
+            face.v[j] = tris[t].v[j] + 1;
+            tmap.neighbours[i].f[j] = face_idx[tris[t].n[j]];
+            tmap.vertex_faces[face.v[j]] = i;
+        }
+        face.weight = 1;
+    }
+    return true;
+}
+
+bool delaunay_triangulation(const QVector<QPointF> &points, TriangulatedMap &tmap,
+                            QString *error)
+{
+    DelaunayTriangulation triangulation;
+    triangulation.build(&points);
+    return triangulation.toMap(tmap, error);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "triangulatedmap.h"
+
+#include <QLineF>
+#include <QPointF>
+#include <QString>
+#include <QVector>
+
+// The Delaunay triangulation of an array of points, kept up to date as
+// points are inserted and removed. Like KdTree it refers to points by their
+// index in the array, and is told when they move.
+//
+// Inserting a point walks to it from a nearby point, then replaces the
+// triangles whose circumcircles it is inside. Removing one re-triangulates
+// just the polygon its triangles leave. Points that are on top of another
+// point, or that come before there are three points not in a line, wait
+// outside the triangulation until they can join it.
+class DelaunayTriangulation
+{
+public:
+    DelaunayTriangulation();
+
+    // Triangulates points from scratch. The triangulation keeps the pointer,
+    // so points has to outlive it or be replaced by another build.
+    void build(const QVector<QPointF> *points);
+    void clear();
+
+    // Moves the triangulation over to another array holding the same
+    // points, such as a copy of the one it was built on.
+    void setPoints(const QVector<QPointF> *points) { this->points = points; }
+
+    // Adds the point at index point, once it is in the array. near is the
+    // index of a point close to it to walk from, if one is known.
+    void insert(int point, int near = -1);
+    // Takes out the point at index point, before it leaves the array.
+    void remove(int point);
+    // Changes the index of a point, for when it moves in the array.
+    void relabel(int from, int to);
+
+    int faceCount() const { return n_faces; }
+
+    // Appends each edge between two points once.
+    void edges(QVector<QLineF> &lines) const;
+
+    // The triangulation as a map, laid out as delaunay_triangulation does.
+    bool toMap(TriangulatedMap &tmap, QString *error = 0) const;
+
+private:
+    // Corners anticlockwise, and n[j] the triangle across the edge opposite
+    // corner j. Dead triangles have v[0] == dead.
+    struct Tri {
+        int v[3];
+        int n[3];
+    };
+
+    // Corner ids that are not points. The outside of the hull is covered by
+    // ghost triangles, each joining a hull edge to the ghost vertex, so
+    // every edge has a triangle on either side.
+    enum { ghost = -2, dead = -3 };
+
+    const QPointF &point(int v) const { return (*points)[v]; }
+    bool is_ghost(int t) const;
+    bool in_circle(int t, const QPointF &p) const;
+    int locate(const QPointF &p, int start) const;
+    int &fan_slot(int v);
+    int new_tri(int a, int b, int c);
+    void free_tri(int t);
+    void link_fan(const QVector<int> &fan);
+    void grow_arrays();
+    void try_start();
+    void start(int a, int b, int c);
+    bool insert_point(int point, int start);
+    void restart();
+
+    const QVector<QPointF> *points;
+    QVector<Tri> tris;
+    QVector<int> free_tris;
+    int n_faces;
+    int last;
+
+    // A live triangle at each point in the triangulation, or -1.
+    QVector<int> vertex_tri;
+    // Points outside the triangulation, in the order they came.
+    QVector<int> waiting;
+
+    // Scratch space for insert_point. A triangle is in the current hole if
+    // its mark is the current stamp, and fan_start holds the new triangle
+    // starting at each vertex of the hole's boundary.
+    QVector<int> mark;
+    int stamp;
+    QVector<int> fan_start;
+    int ghost_fan_start;
+    QVector<int> hole;
+    QVector<int> hole_edges;
+    QVector<int> fan;
+};
+
+// Builds the Delaunay triangulation of points as a map, with adjacency, so
+// a point set can be turned into a map without a separate program.
+//
+// The map is laid out like one read from a file: vertex 0 is the dummy
+// vertex of the file format and point i is vertex i + 1, so saving it
+// writes the points in their original order. Every face gets weight 1.
+// Repeated points are left out of every face. Fails if the points do not
+// span an area.
+bool delaunay_triangulation(const QVector<QPointF> &points, TriangulatedMap &tmap,
+                            QString *error = 0);
@@ -0,0 +1,132 @@
+#include "facebatches.h"
+#include "maprenderer.h"
+#include "perf.h"
+
+#include <limits>
+
+static const int n_levels = 256;
+static const int blocks_per_side = 16;
+static const int n_blocks = blocks_per_side * blocks_per_side;
+
+FaceBatches::FaceBatches()
+{
+    clear();
+}
+
+void FaceBatches::clear()
+{
+    xmin = ymin = 0;
+    block_width = block_height = 1;
+    group_faces.clear();
+    group_paths.clear();
+    group_dirty.clear();
+    block_bounds.clear();
+    face_group.clear();
+    face_position.clear();
+}
+
+void FaceBatches::build(const TMapWrapper &tmap_wrapper)
+{
+    PerfScope scope("build_face_batches");
+    clear();
+    int n_faces = tmap_wrapper.tmap.faces.size();
+    if (n_faces == 0)
+        return;
+
+    xmin = tmap_wrapper.xmin;
+    ymin = tmap_wrapper.ymin;
+    block_width = qMax(tmap_wrapper.xrange / blocks_per_side, std::numeric_limits<qreal>::min());
+    block_height = qMax(tmap_wrapper.yrange / blocks_per_side, std::numeric_limits<qreal>::min());
+
+    group_faces.resize(n_blocks * n_levels);
+    group_paths.resize(n_blocks * n_levels);
+    group_dirty.fill(true, n_blocks * n_levels);
+    block_bounds.resize(n_blocks);
+    face_group.resize(n_faces);
+    face_position.resize(n_faces);
+    for (int i = 0; i < n_faces; i++)
+        add(tmap_wrapper, i);
+}
+
+void FaceBatches::add(const TMapWrapper &tmap_wrapper, int face)
+{
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    QPointF u = tmap.corner(face, 0);
+    QPointF v = tmap.corner(face, 1);
+    QPointF w = tmap.corner(face, 2);
+
+    // A face belongs to the block holding its centroid, and the bounds of
+    // the block grow to take in the whole face.
+    QPointF centroid = (u + v + w) / 3;
+    int col = qBound(0, int((centroid.x() - xmin) / block_width), blocks_per_side - 1);
+    int row = qBound(0, int((centroid.y() - ymin) / block_height), blocks_per_side - 1);
+    int block = row * blocks_per_side + col;
+    qreal left = qMin(u.x(), qMin(v.x(), w.x()));
+    qreal top = qMin(u.y(), qMin(v.y(), w.y()));
+    QRectF bounds(left, top,
+                  qMax(u.x(), qMax(v.x(), w.x())) - left,
+                  qMax(u.y(), qMax(v.y(), w.y())) - top);
+    block_bounds[block] |= bounds;
+
+    int group = block * n_levels + grey_level(tmap_wrapper, tmap.faces[face].weight);
+    face_group[face] = group;
+    face_position[face] = group_faces[group].size();
+    group_faces[group].append(face);
+    group_dirty[group] = true;
+}
+
+void FaceBatches::remove(int face)
+{
+    // Move the last face of the group into the hole.
+    int group = face_group[face];
+    QVector<int> &faces = group_faces[group];
+    int last = faces.last();
+    faces[face_position[face]] = last;
+    face_position[last] = face_position[face];
+    faces.resize(faces.size() - 1);
+    group_dirty[group] = true;
+}
+
+void FaceBatches::faceChanged(const TMapWrapper &tmap_wrapper, int face)
+{
+    if (face < 0 || face >= face_group.size())
+        return;
+
+    int level = grey_level(tmap_wrapper, tmap_wrapper.tmap.faces[face].weight);
+    if (face_group[face] % n_levels == level)
+        return;
+
+    remove(face);
+    add(tmap_wrapper, face);
+}
+
+void FaceBatches::draw(QPainter &painter, const TMapWrapper &tmap_wrapper, const QRectF &visible)
+{
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    for (int level = 0; level < n_levels && !group_faces.empty(); level++) {
+        bool brush_set = false;
+        for (int block = 0; block < n_blocks; block++) {
+            int group = block * n_levels + level;
+            if (group_faces[group].empty() || !block_bounds[block].intersects(visible))
+                continue;
+
+            if (group_dirty[group]) {
+                QPainterPath path;
+                foreach(int face, group_faces[group]) {
+                    path.moveTo(tmap.corner(face, 0));
+                    path.lineTo(tmap.corner(face, 1));
+                    path.lineTo(tmap.corner(face, 2));
+                    path.closeSubpath();
+                }
+                group_paths[group] = path;
+                group_dirty[group] = false;
+            }
+
+            if (!brush_set) {
+                painter.setBrush(QColor(level, level, level));
+                brush_set = true;
+            }
+            painter.drawPath(group_paths[group]);
+        }
+    }
+}
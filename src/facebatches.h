@@ -0,0 +1,49 @@
+#pragma once
+
+#include "tmapwrapper.h"
+
+#include <QPainter>
+#include <QPainterPath>
+#include <QRectF>
+#include <QVector>
+
+// The faces of a map grouped by the grey level they are drawn in, so that a
+// frame takes one brush change per grey level and one drawPath per group
+// rather than a brush and a polygon per face.
+//
+// The map is also split into blocks, and each group only holds the faces of
+// one block, so drawing part of the map skips the groups out of view. The
+// paths are in map coordinates, so they stay valid as the view changes, and
+// a group's path is only built again after a face has joined or left it.
+class FaceBatches
+{
+public:
+    FaceBatches();
+
+    void build(const TMapWrapper &tmap_wrapper);
+    void clear();
+
+    // Moves the face to the group for its current weight.
+    void faceChanged(const TMapWrapper &tmap_wrapper, int face);
+
+    // Draws the groups overlapping visible, with the painter's pen and its
+    // transform set up to map coordinates.
+    void draw(QPainter &painter, const TMapWrapper &tmap_wrapper, const QRectF &visible);
+
+private:
+    void add(const TMapWrapper &tmap_wrapper, int face);
+    void remove(int face);
+
+    qreal xmin, ymin;
+    qreal block_width, block_height;
+
+    // Group g holds the faces of block g / 256 with grey level g % 256.
+    QVector<QVector<int> > group_faces;
+    QVector<QPainterPath> group_paths;
+    QVector<bool> group_dirty;
+    QVector<QRectF> block_bounds;
+
+    // Where each face is in group_faces.
+    QVector<int> face_group;
+    QVector<int> face_position;
+};
@@ -0,0 +1,153 @@
+#include "facegrid.h"
+#include "perf.h"
+
+#include <QtGlobal>
+#include <limits>
+#include <cmath>
+
+// Keeps the cell table a sensible size for maps that are very long and thin
+// or have a huge number of faces.
+static const int max_grid_dim = 4096;
+
+FaceGrid::FaceGrid()
+{
+    clear();
+}
+
+void FaceGrid::clear()
+{
+    xmin = ymin = 0;
+    cell_width = cell_height = 1;
+    cols = rows = 0;
+    cell_start.clear();
+    cell_faces.clear();
+}
+
+int FaceGrid::column(qreal x) const
+{
+    return qBound(0, int((x - xmin) / cell_width), cols - 1);
+}
+
+int FaceGrid::row(qreal y) const
+{
+    return qBound(0, int((y - ymin) / cell_height), rows - 1);
+}
+
+void FaceGrid::build(const TriangulatedMap &tmap)
+{
+    PerfScope scope("build_face_grid");
+    clear();
+    int n_faces = tmap.faces.size();
+    if (n_faces == 0)
+        return;
+
+    qreal xmax, ymax;
+    xmin = ymin = std::numeric_limits<qreal>::max();
+    xmax = ymax = -std::numeric_limits<qreal>::max();
+    foreach(const TriangulatedMap::Face &face, tmap.faces) {
+        for (int j = 0; j < 3; j++) {
+            const QPointF &v = tmap.vertices[face.v[j]];
+            xmin = qMin(xmin, v.x());
+            xmax = qMax(xmax, v.x());
+            ymin = qMin(ymin, v.y());
+            ymax = qMax(ymax, v.y());
+        }
+    }
+
+    // Aim for about one cell per face, shaped to match the map.
+    qreal width = qMax(xmax - xmin, std::numeric_limits<qreal>::min());
+    qreal height = qMax(ymax - ymin, std::numeric_limits<qreal>::min());
+    qreal aspect = width / height;
+    cols = qBound(1, int(std::sqrt(n_faces * aspect)), max_grid_dim);
+    rows = qBound(1, int(std::sqrt(n_faces / aspect)), max_grid_dim);
+    cell_width = width / cols;
+    cell_height = height / rows;
+
+    // Two passes over the faces: count how many faces land in each cell, then
+    // fill in the cell lists at the offsets the counts give us.
+    QVector<int> bounds(4 * n_faces);
+    cell_start.fill(0, cols * rows + 1);
+    for (int i = 0; i < n_faces; i++) {
+        QPointF u = tmap.corner(i, 0);
+        QPointF v = tmap.corner(i, 1);
+        QPointF w = tmap.corner(i, 2);
+        int *b = &bounds[4 * i];
+        b[0] = column(qMin(u.x(), qMin(v.x(), w.x())));
+        b[1] = column(qMax(u.x(), qMax(v.x(), w.x())));
+        b[2] = row(qMin(u.y(), qMin(v.y(), w.y())));
+        b[3] = row(qMax(u.y(), qMax(v.y(), w.y())));
+        for (int r = b[2]; r <= b[3]; r++)
+            for (int c = b[0]; c <= b[1]; c++)
+                cell_start[r * cols + c + 1]++;
+    }
+
+    for (int c = 0; c < cols * rows; c++)
+        cell_start[c + 1] += cell_start[c];
+
+    cell_faces.resize(cell_start.last());
+    QVector<int> next = cell_start;
+    for (int i = 0; i < n_faces; i++) {
+        const int *b = &bounds[4 * i];
+        for (int r = b[2]; r <= b[3]; r++)
+            for (int c = b[0]; c <= b[1]; c++)
+                cell_faces[next[r * cols + c]++] = i;
+    }
+}
+
+int FaceGrid::faceContaining(const TriangulatedMap &tmap, QPointF p) const
+{
+    const int *begin, *end;
+    candidateFaces(p, begin, end);
+    for (const int *i = begin; i != end; ++i) {
+        if (CompGeom::point_in_face(tmap, *i, p))
+            return *i;
+    }
+    return -1;
+}
+
+void FaceGrid::candidateFaces(QPointF p, const int *&begin, const int *&end) const
+{
+    begin = end = 0;
+    if (cols == 0 || p.x() < xmin || p.y() < ymin ||
+        p.x() > xmin + cols * cell_width || p.y() > ymin + rows * cell_height)
+        return;
+
+    int cell = row(p.y()) * cols + column(p.x());
+    begin = cell_faces.constData() + cell_start[cell];
+    end = cell_faces.constData() + cell_start[cell + 1];
+}
+
+void FaceGrid::facesInRect(const TriangulatedMap &tmap, const QRectF &rect,
+                           QVector<int> &faces) const
+{
+    if (cols == 0 || rect.right() < xmin || rect.bottom() < ymin ||
+        rect.left() > xmin + cols * cell_width || rect.top() > ymin + rows * cell_height)
+        return;
+
+    int c0 = column(rect.left()), c1 = column(rect.right());
+    int r0 = row(rect.top()), r1 = row(rect.bottom());
+    for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) {
+            int cell = r * cols + c;
+            for (int k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+                // A face spanning several cells of the rect is only reported
+                // from the first of them, its top left one.
+                int i = cell_faces[k];
+                QPointF u = tmap.corner(i, 0);
+                QPointF v = tmap.corner(i, 1);
+                QPointF w = tmap.corner(i, 2);
+                int first_col = qMax(c0, column(qMin(u.x(), qMin(v.x(), w.x()))));
+                int first_row = qMax(r0, row(qMin(u.y(), qMin(v.y(), w.y()))));
+                if (first_col != c || first_row != r)
+                    continue;
+
+                qreal right = qMax(u.x(), qMax(v.x(), w.x()));
+                qreal bottom = qMax(u.y(), qMax(v.y(), w.y()));
+                if (right >= rect.left() && bottom >= rect.top() &&
+                    qMin(u.x(), qMin(v.x(), w.x())) <= rect.right() &&
+                    qMin(u.y(), qMin(v.y(), w.y())) <= rect.bottom())
+                    faces.append(i);
+            }
+        }
+    }
+}
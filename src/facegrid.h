@@ -0,0 +1,43 @@
+#pragma once
+
+#include "triangulatedmap.h"
+
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+// A uniform grid laid over the faces of a map. Each cell lists the faces
+// whose bounding box overlaps it, so locating a point only has to test the
+// few faces in one cell instead of every face in the map.
+class FaceGrid
+{
+public:
+    FaceGrid();
+
+    void build(const TriangulatedMap &tmap);
+    void clear();
+
+    // Returns the index of the face containing p, or -1 if there is none.
+    int faceContaining(const TriangulatedMap &tmap, QPointF p) const;
+
+    // Sets [begin, end) to the faces that may contain p, those listed in its
+    // cell. The range is empty if p is off the grid.
+    void candidateFaces(QPointF p, const int *&begin, const int *&end) const;
+
+    // Appends to faces the index of every face whose bounding box overlaps
+    // rect, each once.
+    void facesInRect(const TriangulatedMap &tmap, const QRectF &rect,
+                     QVector<int> &faces) const;
+
+private:
+    int column(qreal x) const;
+    int row(qreal y) const;
+
+    qreal xmin, ymin;
+    qreal cell_width, cell_height;
+    int cols, rows;
+
+    // The faces of cell c are cell_faces[cell_start[c] .. cell_start[c + 1]).
+    QVector<int> cell_start;
+    QVector<int> cell_faces;
+};
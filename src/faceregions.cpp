@@ -0,0 +1,327 @@
+#include "faceregions.h"
+#include "maprenderer.h"
+#include "predicates.h"
+#include "perf.h"
+
+#include <QHash>
+#include <QPair>
+#include <QtAlgorithms>
+
+FaceRegions::FaceRegions()
+{
+    clear();
+}
+
+void FaceRegions::clear()
+{
+    regions.clear();
+    free_regions.clear();
+    face_region.clear();
+    face_index.clear();
+}
+
+int FaceRegions::regionCount() const
+{
+    return regions.size() - free_regions.size();
+}
+
+int FaceRegions::new_region(qreal weight)
+{
+    int region;
+    if (free_regions.empty()) {
+        region = regions.size();
+        regions.resize(region + 1);
+    } else {
+        region = free_regions.last();
+        free_regions.resize(free_regions.size() - 1);
+    }
+
+    Region &r = regions[region];
+    r.weight = weight;
+    r.faces.clear();
+    r.outline = QPainterPath();
+    r.bounds = QRectF();
+    r.dirty = true;
+    return region;
+}
+
+void FaceRegions::release_region(int region)
+{
+    regions[region].faces.clear();
+    regions[region].outline = QPainterPath();
+    free_regions.append(region);
+}
+
+void FaceRegions::add_face(int region, int face)
+{
+    face_region[face] = region;
+    face_index[face] = regions[region].faces.size();
+    regions[region].faces.append(face);
+    regions[region].dirty = true;
+}
+
+// Takes the face out of its region by moving the region's last face into
+// its place.
+void FaceRegions::remove_face(int face)
+{
+    QVector<int> &faces = regions[face_region[face]].faces;
+    int last = faces.last();
+    faces[face_index[face]] = last;
+    face_index[last] = face_index[face];
+    faces.resize(faces.size() - 1);
+    regions[face_region[face]].dirty = true;
+    face_region[face] = -1;
+}
+
+// Adds the seed and every face joined to it through faces of the same weight
+// that are not yet in a region to the region.
+void FaceRegions::flood(const TriangulatedMap &tmap, int seed, int region)
+{
+    qreal weight = tmap.faces[seed].weight;
+    Region &r = regions[region];
+    QVector<int> stack;
+    stack.append(seed);
+    face_region[seed] = region;
+    while (!stack.empty()) {
+        int f = stack.last();
+        stack.resize(stack.size() - 1);
+        face_index[f] = r.faces.size();
+        r.faces.append(f);
+        if (!tmap.hasTopology())
+            continue;
+
+        for (int j = 0; j < 3; j++) {
+            int g = tmap.neighbours[f].f[j];
+            if (g != -1 && face_region[g] == -1 && tmap.faces[g].weight == weight) {
+                face_region[g] = region;
+                stack.append(g);
+            }
+        }
+    }
+    r.dirty = true;
+}
+
+// Moves the faces of the smaller region into the larger, leaving into as
+// whichever that is.
+void FaceRegions::merge(int &into, int other)
+{
+    if (regions[other].faces.size() > regions[into].faces.size())
+        qSwap(into, other);
+
+    foreach(int f, regions[other].faces)
+        add_face(into, f);
+    release_region(other);
+}
+
+void FaceRegions::build(const TriangulatedMap &tmap)
+{
+    PerfScope scope("build_face_regions");
+    clear();
+    face_region.fill(-1, tmap.faces.size());
+    face_index.fill(-1, tmap.faces.size());
+    for (int i = 0; i < tmap.faces.size(); i++) {
+        if (face_region[i] == -1)
+            flood(tmap, i, new_region(tmap.faces[i].weight));
+    }
+}
+
+// After face has left the region of the seeds, its neighbours in it, finds
+// whether they are still joined. A search is run from each seed in turn, a
+// face at a time, and searches that meet are joined. Once a group of
+// searches has run out of faces without meeting the rest, it has found a
+// piece that has come away, which is moved to a region of its own. It stops
+// when one group is left, so it goes no further than the smaller pieces,
+// and for most faces the seeds meet round a corner after a few steps.
+void FaceRegions::split_off(const TriangulatedMap &tmap, int face, const QVector<int> &seeds)
+{
+    int old = face_region[seeds[0]];
+    int n = seeds.size();
+    QVector<QVector<int> > found(n);
+    QVector<int> next(n, 0), group(n);
+    QVector<bool> done(n, false);
+    QHash<int, int> search_of;
+    for (int k = 0; k < n; k++) {
+        found[k].append(seeds[k]);
+        search_of.insert(seeds[k], k);
+        group[k] = k;
+    }
+
+    int n_groups = n;
+    while (n_groups > 1) {
+        for (int k = 0; k < n && n_groups > 1; k++) {
+            if (next[k] < found[k].size()) {
+                int f = found[k][next[k]++];
+                for (int j = 0; j < 3; j++) {
+                    int g = tmap.neighbours[f].f[j];
+                    if (g == -1 || g == face || face_region[g] != old)
+                        continue;
+                    int other = search_of.value(g, -1);
+                    if (other == -1) {
+                        search_of.insert(g, k);
+                        found[k].append(g);
+                    } else if (group[other] != group[k]) {
+                        int from = group[other];
+                        for (int i = 0; i < n; i++) {
+                            if (group[i] == from)
+                                group[i] = group[k];
+                        }
+                        n_groups--;
+                    }
+                }
+                continue;
+            }
+
+            // The search has run out. If the others in its group have too,
+            // the group has found all of a piece of the region.
+            bool group_done = true;
+            for (int i = 0; i < n; i++)
+                group_done = group_done && (group[i] != group[k] || next[i] == found[i].size());
+            if (!group_done || done[k])
+                continue;
+
+            int region = new_region(regions[old].weight);
+            for (int i = 0; i < n; i++) {
+                if (group[i] != group[k])
+                    continue;
+                done[i] = true;
+                foreach(int f, found[i]) {
+                    remove_face(f);
+                    add_face(region, f);
+                }
+            }
+            n_groups--;
+        }
+    }
+}
+
+void FaceRegions::faceChanged(const TriangulatedMap &tmap, int face)
+{
+    if (face < 0 || face >= face_region.size())
+        return;
+
+    int old = face_region[face];
+    qreal weight = tmap.faces[face].weight;
+    if (regions[old].weight == weight)
+        return;
+
+    // Take the face out of its region. If it joined more than one other
+    // face of the region, the rest may have fallen apart.
+    QVector<int> seeds;
+    for (int j = 0; tmap.hasTopology() && j < 3; j++) {
+        int g = tmap.neighbours[face].f[j];
+        if (g != -1 && face_region[g] == old && !seeds.contains(g))
+            seeds.append(g);
+    }
+    remove_face(face);
+    if (regions[old].faces.empty())
+        release_region(old);
+    else if (seeds.size() > 1)
+        split_off(tmap, face, seeds);
+
+    // Then join it to the neighbouring regions of its new weight.
+    int region = new_region(weight);
+    add_face(region, face);
+    for (int j = 0; tmap.hasTopology() && j < 3; j++) {
+        int g = tmap.neighbours[face].f[j];
+        if (g != -1 && face_region[g] != region && tmap.faces[g].weight == weight)
+            merge(region, face_region[g]);
+    }
+}
+
+QVector<int> FaceRegions::regionIds() const
+{
+    QVector<int> ids;
+    for (int i = 0; i < regions.size(); i++) {
+        if (!regions[i].faces.empty())
+            ids.append(i);
+    }
+    return ids;
+}
+
+qreal FaceRegions::regionWeight(int region) const
+{
+    return regions[region].weight;
+}
+
+// Chains the edges of the region's faces that do not join another face of
+// the region into rings. Each is directed with the region on its left, so
+// the rings run one way round the region and the other way round its holes.
+QVector<QPolygonF> FaceRegions::regionOutline(const TriangulatedMap &tmap, int region) const
+{
+    QVector<QPair<int, int> > edges;
+    foreach(int f, regions[region].faces) {
+        const TriangulatedMap::Face &face = tmap.faces[f];
+        QPointF u = tmap.vertices[face.v[0]];
+        QPointF v = tmap.vertices[face.v[1]];
+        QPointF w = tmap.vertices[face.v[2]];
+        bool ccw = orient2d(u, v, w) > 0;
+        for (int j = 0; j < 3; j++) {
+            int g = tmap.hasTopology() ? tmap.neighbours[f].f[j] : -1;
+            if (g != -1 && face_region[g] == region)
+                continue;
+            int a = face.v[(j + 1) % 3], b = face.v[(j + 2) % 3];
+            edges.append(ccw ? qMakePair(a, b) : qMakePair(b, a));
+        }
+    }
+    qSort(edges);
+
+    QVector<QPolygonF> rings;
+    QVector<bool> used(edges.size(), false);
+    for (int i = 0; i < edges.size(); i++) {
+        if (used[i])
+            continue;
+
+        int start = edges[i].first;
+        QPolygonF ring;
+        ring << tmap.vertices[start];
+        for (int k = i; k != -1; ) {
+            used[k] = true;
+            int to = edges[k].second;
+            if (to == start)
+                break;
+            ring << tmap.vertices[to];
+
+            // Carry on along an unused edge leaving where this one ends.
+            QVector<QPair<int, int> >::const_iterator it =
+                qLowerBound(edges.constBegin(), edges.constEnd(), qMakePair(to, -1));
+            k = -1;
+            for (; it != edges.constEnd() && it->first == to; ++it) {
+                if (!used[it - edges.constBegin()]) {
+                    k = it - edges.constBegin();
+                    break;
+                }
+            }
+        }
+        rings.append(ring);
+    }
+    return rings;
+}
+
+void FaceRegions::update_outline(const TriangulatedMap &tmap, int region)
+{
+    Region &r = regions[region];
+    QPainterPath outline;
+    foreach(const QPolygonF &ring, regionOutline(tmap, region)) {
+        outline.addPolygon(ring);
+        outline.closeSubpath();
+    }
+    r.outline = outline;
+    r.bounds = outline.boundingRect();
+    r.dirty = false;
+}
+
+void FaceRegions::draw(QPainter &painter, const TMapWrapper &tmap_wrapper, const QRectF &visible)
+{
+    for (int i = 0; i < regions.size(); i++) {
+        if (regions[i].faces.empty())
+            continue;
+        if (regions[i].dirty)
+            update_outline(tmap_wrapper.tmap, i);
+        if (!regions[i].bounds.intersects(visible))
+            continue;
+
+        int grey = grey_level(tmap_wrapper, regions[i].weight);
+        painter.setBrush(QColor(grey, grey, grey));
+        painter.drawPath(regions[i].outline);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "tmapwrapper.h"
+
+#include <QPainter>
+#include <QPainterPath>
+#include <QPolygonF>
+#include <QRectF>
+#include <QVector>
+
+// The map dissolved into regions: connected sets of faces of equal weight,
+// joined across shared edges. Each region is drawn as one polygon, with
+// holes, bounded by the edges between it and other regions or the outside.
+//
+// The regions are kept up to date as weights change. Checking whether the
+// region a face leaves falls apart only goes as far as the smallest piece,
+// so an edit in a big region costs about as much as one in a small one.
+// Without adjacency every face is a region of its own.
+class FaceRegions
+{
+public:
+    FaceRegions();
+
+    void build(const TriangulatedMap &tmap);
+    void clear();
+
+    // Moves the face to a region for its current weight.
+    void faceChanged(const TriangulatedMap &tmap, int face);
+
+    int regionCount() const;
+
+    // The ids of the regions, and what each is made of. The outline is a
+    // ring for the outside of the region and one for each hole.
+    QVector<int> regionIds() const;
+    qreal regionWeight(int region) const;
+    QVector<QPolygonF> regionOutline(const TriangulatedMap &tmap, int region) const;
+
+    // Draws the regions overlapping visible, with the painter's pen and its
+    // transform set up to map coordinates.
+    void draw(QPainter &painter, const TMapWrapper &tmap_wrapper, const QRectF &visible);
+
+private:
+    struct Region {
+        qreal weight;
+        QVector<int> faces;
+        QPainterPath outline;
+        QRectF bounds;
+        bool dirty;
+    };
+
+    int new_region(qreal weight);
+    void release_region(int region);
+    void add_face(int region, int face);
+    void remove_face(int face);
+    void split_off(const TriangulatedMap &tmap, int face, const QVector<int> &seeds);
+    void flood(const TriangulatedMap &tmap, int seed, int region);
+    void merge(int &into, int other);
+    void update_outline(const TriangulatedMap &tmap, int region);
+
+    // Released regions have no faces, and are reused before adding more.
+    QVector<Region> regions;
+    QVector<int> free_regions;
+    QVector<int> face_region;
+    // Where each face is in its region's faces.
+    QVector<int> face_index;
+};
@@ -0,0 +1,430 @@
+#include "generator.h"
+#include "textwriter.h"
+#include "perf.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QPointF>
+#include <QThread>
+#include <QVector>
+#include <QtConcurrentMap>
+#include <QtGlobal>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Lines formatted by each task, as in the writer. A line is never longer
+// than max_line_length.
+static const int chunk_lines = 65536;
+static const int max_line_length = 128;
+
+// Enough that the face and vertex indices still fit in an int.
+static const int max_faces = 1 << 30;
+
+// Jitter in thousandths of a square, on each axis. A quarter would be
+// enough to flip a face.
+static const int grid_jitter = 200;
+static const int random_jitter = 240;
+
+// Each cluster draws vertices towards its centre by up to this fraction
+// of their distance from it, so squares there end up a sixteenth of the
+// area. Below one the pull keeps the order of the vertices along every
+// line out from the centre, so no face is turned over, as long as the
+// cluster is several squares across.
+static const qreal cluster_strength = 0.75;
+static const qreal min_cluster_radius = 8;
+// How far apart clusters are, in their radii.
+static const qreal cluster_spacing = 2.5;
+
+GeneratorOptions::GeneratorOptions()
+    : n_faces(100000), aspect(4.0 / 3), layout(Grid), n_clusters(8),
+      weights(Patches), max_weight(10), levels(10), feature_size(0.05), seed(1)
+{
+}
+
+namespace {
+
+// Salts for the hashes, so each use of the seed gets its own numbers.
+enum { jitter_x_salt = 1, jitter_y_salt, diagonal_salt, weight_salt,
+       noise_salt, cluster_salt };
+
+struct Cluster {
+    qreal x, y;
+    qreal radius2;
+};
+
+// The grid and everything that every line is worked out from.
+struct Generator {
+    const GeneratorOptions *options;
+    int rows, cols;
+    int jitter;
+    bool random_diagonals;
+    QVector<Cluster> clusters;
+};
+
+struct GenerateChunk {
+    const Generator *generator;
+    bool faces;
+    int begin, end;
+    QByteArray text;
+};
+
+}
+
+// The finaliser of splitmix64, which spreads every bit of x over the result.
+static inline quint64 mix(quint64 x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static inline quint64 hash(quint32 seed, int salt, quint64 a)
+{
+    return mix(mix((quint64(seed) << 8 | quint64(salt)) + 0x9e3779b97f4a7c15ull) ^ a);
+}
+
+static inline quint64 pack(int a, int b)
+{
+    return quint64(quint32(a)) << 32 | quint32(b);
+}
+
+// Uniform in [0, 1).
+static inline qreal unit(quint64 h)
+{
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Whether square (r, c) is cut from its top left to its bottom right corner,
+// rather than from bottom left to top right.
+static inline bool flipped(const Generator &g, int r, int c)
+{
+    return g.random_diagonals && (hash(g.options->seed, diagonal_salt, pack(r, c)) & 1);
+}
+
+// The file faces of square (r, c), below and above its diagonal. Squares off
+// the grid have the dummy face.
+static inline int lower_face(const Generator &g, int r, int c)
+{
+    if (r < 0 || r >= g.rows || c < 0 || c >= g.cols)
+        return 0;
+    return 2 * (r * g.cols + c) + 1;
+}
+
+static inline int upper_face(const Generator &g, int r, int c)
+{
+    int f = lower_face(g, r, c);
+    return f ? f + 1 : 0;
+}
+
+// The faces of square (r, c) along each of its sides. The bottom side is
+// always on the lower face and the top on the upper one.
+static inline int left_face(const Generator &g, int r, int c)
+{
+    return flipped(g, r, c) ? lower_face(g, r, c) : upper_face(g, r, c);
+}
+
+static inline int right_face(const Generator &g, int r, int c)
+{
+    return flipped(g, r, c) ? upper_face(g, r, c) : lower_face(g, r, c);
+}
+
+static QPointF warp(const Generator &g, QPointF p)
+{
+    foreach(const Cluster &cluster, g.clusters) {
+        qreal dx = p.x() - cluster.x, dy = p.y() - cluster.y;
+        qreal pull = cluster_strength * std::exp(-(dx * dx + dy * dy) / cluster.radius2);
+        p = QPointF(p.x() - dx * pull, p.y() - dy * pull);
+    }
+    return p;
+}
+
+static inline int thousandths(qreal x)
+{
+    return int(std::floor(x * 1000 + 0.5));
+}
+
+// Where vertex (r, c) ends up, in thousandths of a square.
+static void vertex_position(const Generator &g, int r, int c, int &x, int &y)
+{
+    x = c * 1000;
+    y = r * 1000;
+    if (r > 0 && r < g.rows && c > 0 && c < g.cols) {
+        quint64 v = pack(r, c);
+        int span = 2 * g.jitter + 1;
+        x += int(hash(g.options->seed, jitter_x_salt, v) % span) - g.jitter;
+        y += int(hash(g.options->seed, jitter_y_salt, v) % span) - g.jitter;
+    }
+    if (!g.clusters.empty()) {
+        QPointF p = warp(g, QPointF(x / 1000.0, y / 1000.0));
+        x = thousandths(p.x());
+        y = thousandths(p.y());
+    }
+}
+
+static qreal lattice(quint32 seed, int octave, int i, int j)
+{
+    return unit(hash(seed + octave, noise_salt, pack(i, j)));
+}
+
+// Smooth value noise in [0, 1), with features about a unit apart.
+static qreal value_noise(quint32 seed, int octave, qreal x, qreal y)
+{
+    qreal x0 = std::floor(x), y0 = std::floor(y);
+    int i = int(x0), j = int(y0);
+    qreal fx = x - x0, fy = y - y0;
+    fx = fx * fx * (3 - 2 * fx);
+    fy = fy * fy * (3 - 2 * fy);
+    qreal bottom = lattice(seed, octave, i, j) * (1 - fx) + lattice(seed, octave, i + 1, j) * fx;
+    qreal top = lattice(seed, octave, i, j + 1) * (1 - fx) + lattice(seed, octave, i + 1, j + 1) * fx;
+    return bottom * (1 - fy) + top * fy;
+}
+
+// The weight field at (u, v), where u runs from 0 to 1 across the map, in
+// [0, 1].
+static qreal field(const GeneratorOptions &options, int face, qreal u, qreal v)
+{
+    switch (options.weights) {
+    case GeneratorOptions::Uniform:
+        return 1;
+    case GeneratorOptions::Gradient:
+        return qBound(qreal(0), (u + v * options.aspect) / 2, qreal(1));
+    case GeneratorOptions::Patches:
+        return unit(hash(options.seed, weight_salt,
+                         pack(int(std::floor(u / options.feature_size)),
+                              int(std::floor(v / options.feature_size)))));
+    case GeneratorOptions::Noise: {
+        qreal sum = 0, total = 0, amplitude = 1, frequency = 1 / options.feature_size;
+        for (int octave = 0; octave < 4; octave++) {
+            sum += amplitude * value_noise(options.seed, octave, u * frequency, v * frequency);
+            total += amplitude;
+            amplitude /= 2;
+            frequency *= 2;
+        }
+        return sum / total;
+    }
+    case GeneratorOptions::RandomWeights:
+        return unit(hash(options.seed, weight_salt, quint64(face)));
+    }
+    return 0;
+}
+
+// Both faces of a square share the weight at its centre, unless the weights
+// are random.
+static qreal face_weight(const Generator &g, int face, int r, int c)
+{
+    const GeneratorOptions &options = *g.options;
+    QPointF centre = warp(g, QPointF(c + 0.5, r + 0.5));
+    qreal f = field(options, face, centre.x() / g.cols, centre.y() / g.cols);
+    if (options.levels == 0)
+        return f * options.max_weight;
+    int level = qMin(options.levels - 1, int(f * options.levels));
+    return (level + 1) * options.max_weight / options.levels;
+}
+
+// Writes a number of thousandths as a decimal, without trailing zeros.
+static char *put_fixed(char *p, int n)
+{
+    if (n < 0) {
+        *p++ = '-';
+        n = -n;
+    }
+    p = put_int(p, n / 1000);
+    int fraction = n % 1000;
+    if (fraction) {
+        *p++ = '.';
+        for (int scale = 100; fraction; scale /= 10) {
+            *p++ = char('0' + fraction / scale);
+            fraction %= scale;
+        }
+    }
+    return p;
+}
+
+static char *put_vertex(char *p, const Generator &g, int v)
+{
+    int r = v / (g.cols + 1), c = v % (g.cols + 1);
+    int x, y;
+    vertex_position(g, r, c, x, y);
+
+    // A face of one of the squares the vertex is a corner of.
+    int face;
+    if (r < g.rows && c < g.cols)
+        face = lower_face(g, r, c);
+    else if (c < g.cols)
+        face = upper_face(g, r - 1, c);
+    else if (r < g.rows)
+        face = lower_face(g, r, c - 1);
+    else
+        face = upper_face(g, r - 1, c - 1);
+
+    p = put_fixed(p, x);
+    *p++ = ' ';
+    p = put_fixed(p, y);
+    memcpy(p, " 0 ", 3);
+    return put_int(p + 3, face);
+}
+
+// Writes file face f + 1. With A, B, C and D the bottom left, bottom right,
+// top right and top left corners of its square, the faces are ABC and ACD,
+// or ABD and BCD when the square is flipped. Either way they are
+// anticlockwise.
+static char *put_face(char *p, const Generator &g, int f)
+{
+    int square = f / 2;
+    int r = square / g.cols, c = square % g.cols;
+    bool upper = f % 2;
+    int a = r * (g.cols + 1) + c, b = a + 1, d = a + g.cols + 1, cc = d + 1;
+
+    int corners[3], adjacent[3];
+    if (!flipped(g, r, c)) {
+        if (!upper) {
+            corners[0] = a; corners[1] = b; corners[2] = cc;
+            adjacent[0] = left_face(g, r, c + 1);
+            adjacent[1] = upper_face(g, r, c);
+            adjacent[2] = upper_face(g, r - 1, c);
+        } else {
+            corners[0] = a; corners[1] = cc; corners[2] = d;
+            adjacent[0] = lower_face(g, r + 1, c);
+            adjacent[1] = right_face(g, r, c - 1);
+            adjacent[2] = lower_face(g, r, c);
+        }
+    } else {
+        if (!upper) {
+            corners[0] = a; corners[1] = b; corners[2] = d;
+            adjacent[0] = upper_face(g, r, c);
+            adjacent[1] = right_face(g, r, c - 1);
+            adjacent[2] = upper_face(g, r - 1, c);
+        } else {
+            corners[0] = b; corners[1] = cc; corners[2] = d;
+            adjacent[0] = lower_face(g, r + 1, c);
+            adjacent[1] = lower_face(g, r, c);
+            adjacent[2] = left_face(g, r, c + 1);
+        }
+    }
+
+    for (int j = 0; j < 3; j++) {
+        p = put_int(p, corners[j]);
+        *p++ = ' ';
+    }
+    for (int j = 0; j < 3; j++) {
+        p = put_int(p, adjacent[j]);
+        *p++ = ' ';
+    }
+    return put_real(p, face_weight(g, f + 1, r, c));
+}
+
+static void generate_chunk(GenerateChunk &chunk)
+{
+    const Generator &g = *chunk.generator;
+    chunk.text.resize((chunk.end - chunk.begin) * max_line_length);
+    char *start = chunk.text.data();
+    char *p = start;
+
+    for (int i = chunk.begin; i < chunk.end; i++) {
+        p = chunk.faces ? put_face(p, g, i) : put_vertex(p, g, i);
+        *p++ = '\n';
+    }
+
+    chunk.text.resize(int(p - start));
+}
+
+// Formats n vertex or face lines a batch of chunks at a time, as the writer
+// does.
+static bool generate_lines(QFile &file, const Generator &g, bool faces, int n)
+{
+    int n_tasks = 4 * QThread::idealThreadCount();
+    for (int begin = 0; begin < n; ) {
+        QVector<GenerateChunk> chunks;
+        for (int t = 0; t < n_tasks && begin < n; t++) {
+            GenerateChunk chunk;
+            chunk.generator = &g;
+            chunk.faces = faces;
+            chunk.begin = begin;
+            chunk.end = qMin(n, begin + chunk_lines);
+            chunks.append(chunk);
+            begin = chunk.end;
+        }
+
+        if (chunks.size() > 1)
+            QtConcurrent::blockingMap(chunks, generate_chunk);
+        else
+            generate_chunk(chunks[0]);
+
+        foreach(const GenerateChunk &chunk, chunks) {
+            if (file.write(chunk.text) != chunk.text.size())
+                return false;
+        }
+    }
+    return true;
+}
+
+bool generate_triangulation(const QString &path, const GeneratorOptions &options,
+                            QString *error)
+{
+    PerfScope scope("generate_triangulation");
+    if (options.n_faces < 2 || options.n_faces > max_faces || !(options.aspect > 0) ||
+        options.n_clusters < 0 || options.levels < 0 || !(options.feature_size > 0)) {
+        if (error)
+            *error = QString("%1: bad generator options").arg(path);
+        return false;
+    }
+
+    Generator g;
+    g.options = &options;
+    g.cols = qMax(1, int(std::sqrt(options.n_faces / 2.0 * options.aspect) + 0.5));
+    g.rows = qMax(1, int(options.n_faces / 2.0 / g.cols + 0.5));
+    g.jitter = options.layout == GeneratorOptions::Grid ? grid_jitter : random_jitter;
+    g.random_diagonals = options.layout != GeneratorOptions::Grid;
+    if (options.layout == GeneratorOptions::Clustered) {
+        g.jitter = grid_jitter;
+        // Clusters are kept apart, since where they overlap their pulls add
+        // up and squares would shrink to nothing. Small maps get as many as
+        // fit.
+        QVector<qreal> radii;
+        for (int k = 0; k < 20 * options.n_clusters && g.clusters.size() < options.n_clusters; k++) {
+            Cluster cluster;
+            cluster.x = (0.1 + 0.8 * unit(hash(options.seed, cluster_salt, 3 * k))) * g.cols;
+            cluster.y = (0.1 + 0.8 * unit(hash(options.seed, cluster_salt, 3 * k + 1))) * g.rows;
+            qreal radius = (0.03 + 0.09 * unit(hash(options.seed, cluster_salt, 3 * k + 2))) * g.cols;
+            radius = qMax(radius, min_cluster_radius);
+            cluster.radius2 = radius * radius;
+
+            bool apart = true;
+            for (int i = 0; i < g.clusters.size() && apart; i++) {
+                qreal dx = cluster.x - g.clusters[i].x, dy = cluster.y - g.clusters[i].y;
+                qreal gap = cluster_spacing * (radius + radii[i]);
+                apart = dx * dx + dy * dy >= gap * gap;
+            }
+            if (apart) {
+                g.clusters.append(cluster);
+                radii.append(radius);
+            }
+        }
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (error)
+            *error = QString("%1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+
+    int n_vertices = (g.rows + 1) * (g.cols + 1);
+    int n_faces = 2 * g.rows * g.cols;
+    char header[32];
+    sprintf(header, "%d %d\n", n_vertices, n_faces + 1);
+    bool ok = file.write(header) == qint64(strlen(header)) &&
+              generate_lines(file, g, false, n_vertices) &&
+              file.write("0 0 0 0 0 0 inf\n") == 16 &&
+              generate_lines(file, g, true, n_faces);
+    if (!ok) {
+        if (error)
+            *error = QString("%1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QString>
+
+// Generates weighted triangulations of any size, for stress tests and for
+// measuring how things scale. The map is a grid of rows by cols squares,
+// each cut in two along a diagonal, so the faces and vertices around any
+// face follow from its index. Every line of the file is worked out on its
+// own, and the file is formatted in parallel and written out a batch of
+// chunks at a time, so memory use does not grow with the map.
+//
+// Vertex (r, c) starts at (c, r) and is moved by a random jitter of less
+// than a quarter of a square, which keeps every face the right way round.
+// Coordinates are written with three decimals, so the files read back the
+// same everywhere.
+
+struct GeneratorOptions {
+    // Grid keeps every diagonal the same way. Random picks each diagonal at
+    // random and jitters further. Clustered also draws the vertices in
+    // towards a few random centres, making dense patches of small faces.
+    enum Layout { Grid, Random, Clustered };
+
+    // The shape of the weights before they are rounded: the same everywhere,
+    // rising from one corner to the other, constant over square patches,
+    // smooth noise, or random for each face.
+    enum WeightField { Uniform, Gradient, Patches, Noise, RandomWeights };
+
+    GeneratorOptions();
+
+    // The map has about this many faces, besides the dummy face.
+    int n_faces;
+    // Width over height of the grid.
+    qreal aspect;
+    Layout layout;
+    int n_clusters;
+
+    WeightField weights;
+    qreal max_weight;
+    // Weights are rounded up to the nearest of levels even steps up to
+    // max_weight, or left as they are if levels is 0.
+    int levels;
+    // The size of the patches and of the noise, as a fraction of the width.
+    qreal feature_size;
+
+    // The same options and seed always give the same file.
+    quint32 seed;
+};
+
+// Writes a map in the format of operator>>, adjacency and all.
+bool generate_triangulation(const QString &path, const GeneratorOptions &options,
+                            QString *error = 0);
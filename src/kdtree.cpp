@@ -0,0 +1,296 @@
+#include "kdtree.h"
+#include "perf.h"
+
+#include <QtGlobal>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+static inline qreal coord(const QPointF &p, int axis)
+{
+    return axis == 0 ? p.x() : p.y();
+}
+
+static inline qreal dist2(const QPointF &a, const QPointF &b)
+{
+    QPointF delta = (a - b);
+    return (delta.x() * delta.x()) + (delta.y() * delta.y());
+}
+
+// Makes room for ids up to size - 1, with the new ones not in the tree.
+static void grow_ids(QVector<int> &node_of_id, int size)
+{
+    int old_size = node_of_id.size();
+    if (size <= old_size)
+        return;
+    node_of_id.resize(size);
+    std::fill(node_of_id.begin() + old_size, node_of_id.end(), -1);
+}
+
+// Orders point ids along one axis, for nth_element when splitting.
+struct AxisLess {
+    const QPointF *points;
+    int axis;
+    bool operator()(int a, int b) const {
+        return coord(points[a], axis) < coord(points[b], axis);
+    }
+};
+
+// Inserts beyond this depth make the tree rebuild itself. A balanced tree
+// is about log2(n) deep, so this leaves a lot of slack before paying for it.
+static int depth_limit(int n)
+{
+    return 2 * int(std::ceil(std::log(qreal(n + 1)) / std::log(2.0))) + 8;
+}
+
+KdTree::KdTree()
+{
+    clear();
+}
+
+void KdTree::clear()
+{
+    nodes.clear();
+    node_of_id.clear();
+    root = -1;
+    n_live = n_removed = 0;
+    max_depth = depth_limit(0);
+}
+
+void KdTree::build(const QVector<QPointF> &points)
+{
+    QVector<int> ids(points.size());
+    for (int i = 0; i < ids.size(); i++)
+        ids[i] = i;
+    build(points, ids);
+}
+
+void KdTree::build(const QVector<QPointF> &points, const QVector<int> &ids)
+{
+    PerfScope scope("build_kd_tree");
+    clear();
+    if (ids.empty())
+        return;
+
+    int max_id = 0;
+    foreach(int id, ids)
+        max_id = qMax(max_id, id);
+    node_of_id.fill(-1, max_id + 1);
+
+    QVector<int> order = ids;
+    nodes.reserve(ids.size());
+    root = build_range(points.constData(), order.data(), order.size(), 0);
+
+    n_live = ids.size();
+    max_depth = depth_limit(n_live);
+}
+
+int KdTree::build_range(const QPointF *points, int *ids, int n, int axis)
+{
+    if (n == 0)
+        return -1;
+
+    // Split at the median along this axis, so each half is within one point
+    // of the other and the tree stays log2(n) deep.
+    int mid = n / 2;
+    AxisLess less = { points, axis };
+    std::nth_element(ids, ids + mid, ids + n, less);
+
+    Node node;
+    node.p = points[ids[mid]];
+    node.id = ids[mid];
+    node.axis = axis;
+    node.removed = false;
+    int idx = nodes.size();
+    nodes.append(node);
+    node_of_id[node.id] = idx;
+
+    int left = build_range(points, ids, mid, axis ^ 1);
+    int right = build_range(points, ids + mid + 1, n - mid - 1, axis ^ 1);
+    nodes[idx].left = left;
+    nodes[idx].right = right;
+    return idx;
+}
+
+void KdTree::rebuild()
+{
+    QVector<QPointF> points(node_of_id.size());
+    QVector<int> ids;
+    ids.reserve(n_live);
+    foreach(const Node &node, nodes) {
+        if (node.removed)
+            continue;
+        points[node.id] = node.p;
+        ids.append(node.id);
+    }
+    build(points, ids);
+}
+
+void KdTree::insert(int id, QPointF p)
+{
+    grow_ids(node_of_id, id + 1);
+
+    Node node;
+    node.p = p;
+    node.id = id;
+    node.left = node.right = -1;
+    node.removed = false;
+
+    int depth = 0;
+    if (root == -1) {
+        node.axis = 0;
+        root = nodes.size();
+    } else {
+        int parent = root;
+        for (;;) {
+            depth++;
+            Node &n = nodes[parent];
+            int &child = coord(p, n.axis) < coord(n.p, n.axis) ? n.left : n.right;
+            if (child == -1) {
+                node.axis = n.axis ^ 1;
+                child = nodes.size();
+                break;
+            }
+            parent = child;
+        }
+    }
+
+    node_of_id[id] = nodes.size();
+    nodes.append(node);
+    n_live++;
+
+    if (depth > max_depth)
+        rebuild();
+}
+
+void KdTree::remove(int id)
+{
+    if (id < 0 || id >= node_of_id.size() || node_of_id[id] == -1)
+        return;
+
+    nodes[node_of_id[id]].removed = true;
+    node_of_id[id] = -1;
+    n_live--;
+    n_removed++;
+
+    if (n_live == 0)
+        clear();
+    else if (n_removed > n_live)
+        rebuild();
+}
+
+void KdTree::relabel(int from, int to)
+{
+    if (from < 0 || to < 0 || from >= node_of_id.size() || node_of_id[from] == -1)
+        return;
+
+    grow_ids(node_of_id, to + 1);
+
+    int node = node_of_id[from];
+    node_of_id[from] = -1;
+    node_of_id[to] = node;
+    nodes[node].id = to;
+}
+
+int KdTree::nearest(QPointF p) const
+{
+    Candidate best = { std::numeric_limits<qreal>::max(), -1 };
+    if (root != -1)
+        nearest_in(root, p, best);
+    return best.id;
+}
+
+void KdTree::nearest_in(int idx, QPointF p, Candidate &best) const
+{
+    while (idx != -1) {
+        const Node &node = nodes[idx];
+        if (!node.removed) {
+            qreal d2 = dist2(p, node.p);
+            if (d2 < best.dist2) {
+                best.dist2 = d2;
+                best.id = node.id;
+            }
+        }
+
+        // Search the side p is on first. The other side can only hold a
+        // closer point if the splitting line is closer than the best so far.
+        qreal diff = coord(p, node.axis) - coord(node.p, node.axis);
+        int near_side = diff < 0 ? node.left : node.right;
+        int far_side = diff < 0 ? node.right : node.left;
+        if (far_side != -1 && diff * diff < best.dist2) {
+            nearest_in(near_side, p, best);
+            if (diff * diff >= best.dist2)
+                return;
+            idx = far_side;
+        } else {
+            idx = near_side;
+        }
+    }
+}
+
+QVector<int> KdTree::nearest(QPointF p, int k) const
+{
+    QVector<Candidate> heap;
+    if (root != -1 && k > 0) {
+        heap.reserve(k);
+        nearest_in(root, p, k, heap);
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+    QVector<int> ids(heap.size());
+    for (int i = 0; i < heap.size(); i++)
+        ids[i] = heap[i].id;
+    return ids;
+}
+
+void KdTree::nearest_in(int idx, QPointF p, int k, QVector<Candidate> &heap) const
+{
+    // heap is a max-heap on distance holding the k closest points found so
+    // far, so its front is the distance a point has to beat.
+    while (idx != -1) {
+        const Node &node = nodes[idx];
+        if (!node.removed) {
+            Candidate c = { dist2(p, node.p), node.id };
+            if (heap.size() < k) {
+                heap.append(c);
+                std::push_heap(heap.begin(), heap.end());
+            } else if (c.dist2 < heap.first().dist2) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.last() = c;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+
+        qreal diff = coord(p, node.axis) - coord(node.p, node.axis);
+        int near_side = diff < 0 ? node.left : node.right;
+        int far_side = diff < 0 ? node.right : node.left;
+        nearest_in(near_side, p, k, heap);
+        if (heap.size() == k && diff * diff >= heap.first().dist2)
+            return;
+        idx = far_side;
+    }
+}
+
+QVector<int> KdTree::within(QPointF p, qreal radius) const
+{
+    QVector<int> ids;
+    if (root != -1)
+        within_in(root, p, radius * radius, ids);
+    return ids;
+}
+
+void KdTree::within_in(int idx, QPointF p, qreal radius2, QVector<int> &out) const
+{
+    while (idx != -1) {
+        const Node &node = nodes[idx];
+        if (!node.removed && dist2(p, node.p) <= radius2)
+            out.append(node.id);
+
+        qreal diff = coord(p, node.axis) - coord(node.p, node.axis);
+        int near_side = diff < 0 ? node.left : node.right;
+        int far_side = diff < 0 ? node.right : node.left;
+        if (diff * diff <= radius2)
+            within_in(far_side, p, radius2, out);
+        idx = near_side;
+    }
+}
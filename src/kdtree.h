@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QPointF>
+#include <QVector>
+
+// A 2d tree over points labelled with integer ids, answering nearest
+// neighbour, k-nearest and radius queries in logarithmic time. Points can be
+// inserted and removed after the tree is built. Removed points are only
+// marked, and the tree rebuilds itself once too many have piled up or
+// inserts have made it too deep.
+class KdTree
+{
+public:
+    KdTree();
+
+    // Builds the tree over points, using each point's index as its id. The
+    // second form only takes the points listed in ids.
+    void build(const QVector<QPointF> &points);
+    void build(const QVector<QPointF> &points, const QVector<int> &ids);
+    void clear();
+
+    void insert(int id, QPointF p);
+    void remove(int id);
+    // Changes the id of a point, for when it moves to a new index in the
+    // array the ids refer to.
+    void relabel(int from, int to);
+
+    int size() const { return n_live; }
+
+    // The id of the point closest to p, or -1 if the tree is empty.
+    int nearest(QPointF p) const;
+    // The ids of the k points closest to p, closest first.
+    QVector<int> nearest(QPointF p, int k) const;
+    // The ids of all the points within radius of p, in no particular order.
+    QVector<int> within(QPointF p, qreal radius) const;
+
+private:
+    struct Node {
+        QPointF p;
+        int id;
+        int left, right;
+        int axis;
+        bool removed;
+    };
+
+    struct Candidate {
+        qreal dist2;
+        int id;
+        bool operator<(const Candidate &o) const { return dist2 < o.dist2; }
+    };
+
+    int build_range(const QPointF *points, int *ids, int n, int axis);
+    void rebuild();
+
+    void nearest_in(int node, QPointF p, Candidate &best) const;
+    void nearest_in(int node, QPointF p, int k, QVector<Candidate> &heap) const;
+    void within_in(int node, QPointF p, qreal radius2, QVector<int> &out) const;
+
+    QVector<Node> nodes;
+    QVector<int> node_of_id;
+    int root;
+    int n_live;
+    int n_removed;
+    int max_depth;
+};
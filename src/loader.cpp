@@ -0,0 +1,155 @@
+#include "loader.h"
+#include "textreader.h"
+#include "binaryformat.h"
+#include "perf.h"
+
+#include <QTimer>
+#include <QtDebug>
+
+static const int poll_interval = 100;
+
+Loader::Loader(QObject *parent)
+    : QThread(parent), progress(0), generation(0), ok(false)
+{
+    timer = new QTimer(this);
+    timer->setInterval(poll_interval);
+    connect(timer, SIGNAL(timeout()), this, SLOT(poll()));
+    connect(this, SIGNAL(done(int)), this, SLOT(finish(int)), Qt::QueuedConnection);
+}
+
+Loader::~Loader()
+{
+    stop();
+}
+
+void Loader::load(const QString &path)
+{
+    stop();
+    load_path = path;
+    begin();
+}
+
+void Loader::begin()
+{
+    progress = new Progress;
+    generation++;
+    start();
+    timer->start();
+    emit progressChanged(0);
+    emit loadingChanged(true);
+}
+
+void Loader::cancel()
+{
+    if (progress)
+        progress->cancel();
+}
+
+void Loader::stop()
+{
+    cancel();
+    wait();
+    delete progress;
+    progress = 0;
+}
+
+void Loader::run()
+{
+    int this_generation = generation;
+    error.clear();
+    {
+        PerfScope scope("load");
+        ok = loadFile(load_path, *progress, error);
+    }
+    progress->endStage();
+    emit done(this_generation);
+}
+
+void Loader::poll()
+{
+    if (progress)
+        emit progressChanged(progress->value());
+}
+
+void Loader::finish(int finished_generation)
+{
+    if (finished_generation != generation || !progress)
+        return;
+
+    wait();
+    bool canceled = progress->isCanceled();
+    delete progress;
+    progress = 0;
+    timer->stop();
+    emit loadingChanged(false);
+
+    // A load canceled after the worker finished still counts as canceled,
+    // so it doesn't replace whatever the user has done since.
+    if (canceled)
+        return;
+    if (ok)
+        emit loaded();
+    else
+        qWarning() << qPrintable(error);
+}
+
+bool MapLoader::loadFile(const QString &path, Progress &progress, QString &error)
+{
+    TriangulatedMap tmap;
+    progress.beginStage(500);
+    bool read = is_binary_triangulation(path)
+        ? read_binary_triangulation(path, tmap, &error, &progress)
+        : read_triangulation(path, tmap, &error, &progress);
+    if (!read || progress.isCanceled())
+        return false;
+
+    progress.beginStage(200);
+    tmap_wrapper.setMap(tmap);
+    if (progress.isCanceled())
+        return false;
+
+    progress.beginStage(100);
+    batches.build(tmap_wrapper);
+    if (progress.isCanceled())
+        return false;
+
+    progress.beginStage(200);
+    pyramid.build(tmap_wrapper, &progress);
+    return !progress.isCanceled();
+}
+
+bool PointSetLoader::loadFile(const QString &path, Progress &progress, QString &error)
+{
+    progress.beginStage(500);
+    bool read = is_binary_point_set(path)
+        ? read_binary_point_set(path, points, &error, &progress)
+        : read_point_set(path, points, &error, &progress);
+    if (!read || progress.isCanceled())
+        return false;
+
+    progress.beginStage(100);
+    point_tree.build(points);
+    if (progress.isCanceled())
+        return false;
+
+    progress.beginStage(400);
+    delaunay.build(&points);
+    return !progress.isCanceled();
+}
+
+void PyramidLoader::build(const TMapWrapper &tmap_wrapper)
+{
+    // The copy shares the map's data until the map is next edited, and
+    // keeps the worker clear of those edits.
+    stop();
+    source = tmap_wrapper;
+    begin();
+}
+
+bool PyramidLoader::loadFile(const QString &, Progress &progress, QString &)
+{
+    progress.beginStage(Progress::scale);
+    pyramid.build(source, &progress);
+    source = TMapWrapper();
+    return !progress.isCanceled();
+}
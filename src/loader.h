@@ -0,0 +1,123 @@
+#pragma once
+
+#include "tmapwrapper.h"
+#include "facebatches.h"
+#include "mappyramid.h"
+#include "delaunay.h"
+#include "kdtree.h"
+#include "progress.h"
+
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+class QTimer;
+
+// Loads a file on a worker thread, so the window stays responsive and the
+// map or point set already open can still be used until the new one is
+// ready. The loaded data is built up in the loader, and the widget takes
+// it over in one go when loaded is emitted.
+class Loader : public QThread
+{
+    Q_OBJECT
+
+public:
+    Loader(QObject *parent = 0);
+    ~Loader();
+
+    // Starts loading path, dropping any load still under way.
+    void load(const QString &path);
+    QString path() const { return load_path; }
+
+public slots:
+    void cancel();
+
+signals:
+    // How far the load has got, out of Progress::scale.
+    void progressChanged(int value);
+    void loadingChanged(bool loading);
+    // The load worked. Failures are reported with qWarning, unless the load
+    // was canceled.
+    void loaded();
+
+    // Sent from the worker thread as a load ends. Loads that have since been
+    // replaced by another are ignored.
+    void done(int generation);
+
+protected:
+    // Reads path and builds everything the widget needs from it, on the
+    // worker thread. The progress is at the start of its first stage.
+    virtual bool loadFile(const QString &path, Progress &progress, QString &error) = 0;
+
+    // Starts the worker on the path and whatever else the subclass has set
+    // up since calling stop().
+    void begin();
+    void run();
+    // Cancels any load under way and waits for it to end. Subclasses call
+    // this from their destructors, since the worker uses their loadFile.
+    void stop();
+
+private slots:
+    void poll();
+    void finish(int generation);
+
+private:
+
+    QString load_path;
+    Progress *progress;
+    QTimer *timer;
+    int generation;
+    bool ok;
+    QString error;
+};
+
+class MapLoader : public Loader
+{
+public:
+    MapLoader(QObject *parent = 0) : Loader(parent) {}
+    ~MapLoader() { stop(); }
+
+    TMapWrapper tmap_wrapper;
+    FaceBatches batches;
+    MapPyramid pyramid;
+
+protected:
+    bool loadFile(const QString &path, Progress &progress, QString &error);
+};
+
+class PointSetLoader : public Loader
+{
+public:
+    PointSetLoader(QObject *parent = 0) : Loader(parent) {}
+    ~PointSetLoader() { stop(); }
+
+    // The triangulation refers to points, so whoever takes them over has to
+    // point it at their copy with setPoints.
+    QVector<QPointF> points;
+    KdTree point_tree;
+    DelaunayTriangulation delaunay;
+
+protected:
+    bool loadFile(const QString &path, Progress &progress, QString &error);
+};
+
+// Builds the pyramid of a map that has been edited or set directly, rather
+// than loaded, so the window doesn't wait on it.
+class PyramidLoader : public Loader
+{
+public:
+    PyramidLoader(QObject *parent = 0) : Loader(parent) {}
+    ~PyramidLoader() { stop(); }
+
+    // Starts building the pyramid of a copy of tmap_wrapper, dropping any
+    // build still under way.
+    void build(const TMapWrapper &tmap_wrapper);
+
+    MapPyramid pyramid;
+
+protected:
+    bool loadFile(const QString &path, Progress &progress, QString &error);
+
+private:
+    TMapWrapper source;
+};
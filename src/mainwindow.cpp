@@ -3,6 +3,7 @@
 #include "mainwindow.h"
 #include "pointseteditor.h"
 #include "rendertriangulation.h"
+#include "perf.h"
 
 MainWindow::MainWindow()
 {
@@ -21,6 +22,7 @@ MainWindow::MainWindow()
 
     createActions();
     createMenus();
+    createStatusBar();
 
     setPointEditorMode(true);
     setTriangulationEditorMode(false);
@@ -28,11 +30,13 @@ MainWindow::MainWindow()
     QStringList argv = qApp->arguments();
     if (argv.size() >= 2) {
         QString path = argv.last();
-        if (path.endsWith(".txt", Qt::CaseInsensitive)) {
+        if (path.endsWith(".txt", Qt::CaseInsensitive) ||
+            path.endsWith(".wtb", Qt::CaseInsensitive)) {
             enableTriangulationEditor();
             triangulation_path = path;
             renderTriangulation->setTriangulation(path);
-        } else if (path.endsWith(".node", Qt::CaseInsensitive)) {
+        } else if (path.endsWith(".node", Qt::CaseInsensitive) ||
+                   path.endsWith(".wpb", Qt::CaseInsensitive)) {
             enablePointEditor();
             point_path = path;
             pointSetEditor->renderPointSet->open(path);
@@ -52,7 +56,7 @@ void MainWindow::openPointSet()
 {
     QString path = QFileDialog::getOpenFileName(
         this, tr("Open Point Set"), point_path,
-        tr("Point Set Files (*.node)"));
+        tr("Point Set Files (*.node *.wpb)"));
 
     if (!path.isEmpty()) {
         enablePointEditor();
@@ -65,7 +69,7 @@ void MainWindow::savePointSetAs()
 {
     QString path = QFileDialog::getSaveFileName(
         this, tr("Save Point Set"), point_path,
-        tr("Point Set Files (*.node)"));
+        tr("Point Set Files (*.node);;Binary Point Set Files (*.wpb)"));
 
     if (!path.isEmpty()) {
         point_path = path;
@@ -86,11 +90,31 @@ void MainWindow::addPointSetGrid()
     pointSetEditor->renderPointSet->addGrid(rows, cols);
 }
 
+void MainWindow::triangulatePointSet()
+{
+    TriangulatedMap tmap;
+    QString error;
+    if (!pointSetEditor->renderPointSet->triangulation().toMap(tmap, &error)) {
+        qWarning() << error;
+        return;
+    }
+
+    // Suggest saving next to the point set.
+    triangulation_path.clear();
+    if (!point_path.isEmpty()) {
+        QFileInfo info(point_path);
+        triangulation_path = info.dir().path() + "/" + info.completeBaseName() + ".txt";
+    }
+
+    enableTriangulationEditor();
+    renderTriangulation->setTriangulation(tmap);
+}
+
 void MainWindow::openTriangulation()
 {
     QString path = QFileDialog::getOpenFileName(
         this, tr("Open Weighted Region"), triangulation_path,
-        tr("Weighted Triangulation Files (*.txt)"));
+        tr("Weighted Triangulation Files (*.txt *.wtb)"));
 
     if (!path.isEmpty()) {
         enableTriangulationEditor();
@@ -103,7 +127,7 @@ void MainWindow::saveTriangulationAs()
 {
     QString path = QFileDialog::getSaveFileName(
         this, tr("Save Triangulation As"), triangulation_path,
-        tr("Weighted Triangulation Files (*.txt)"));
+        tr("Weighted Triangulation Files (*.txt);;Binary Weighted Triangulation Files (*.wtb)"));
 
     if (!path.isEmpty()) {
         triangulation_path = path;
@@ -111,7 +135,7 @@ void MainWindow::saveTriangulationAs()
     }
 }
 
-void MainWindow::renderTriangulationEPS()
+void MainWindow::renderTriangulationVector()
 {
     QString path;
     if (!triangulation_path.isEmpty()) {
@@ -120,11 +144,33 @@ void MainWindow::renderTriangulationEPS()
     }
 
     path = QFileDialog::getSaveFileName(
-        this, tr("Save EPS"), path,
-        tr("Encapsulated Postscript (*.eps)"));
+        this, tr("Save Figure"), path,
+        tr("Encapsulated Postscript (*.eps);;SVG Images (*.svg);;PDF Documents (*.pdf)"));
 
     if (!path.isEmpty())
-        renderTriangulation->renderEPS(path);
+        renderTriangulation->renderVector(path);
+}
+
+void MainWindow::renderTriangulationImage()
+{
+    QString path;
+    if (!triangulation_path.isEmpty()) {
+        QFileInfo info(triangulation_path);
+        path = info.dir().path() + "/" + info.completeBaseName() + ".png";
+    }
+
+    path = QFileDialog::getSaveFileName(
+        this, tr("Save Image"), path,
+        tr("PNG Images (*.png);;TIFF Images (*.tif *.tiff)"));
+    if (path.isEmpty())
+        return;
+
+    bool ok;
+    int size = QInputDialog::getInt(
+        this, tr("Render Image"), tr("Longest side in pixels:"),
+        4000, 1, 30000, 1000, &ok);
+    if (ok)
+        renderTriangulation->renderImage(path, size);
 }
 
 void MainWindow::createActions()
@@ -145,6 +191,11 @@ void MainWindow::createActions()
     addPointSetGridAct->setStatusTip(tr("Add a regular grid of points to the point set"));
     connect(addPointSetGridAct, SIGNAL(triggered()), this, SLOT(addPointSetGrid()));
 
+    triangulatePointSetAct = new QAction(tr("&Triangulate Point Set"), this);
+    triangulatePointSetAct->setShortcut(tr("Ctrl+T"));
+    triangulatePointSetAct->setStatusTip(tr("Open the Delaunay triangulation of the point set for editing"));
+    connect(triangulatePointSetAct, SIGNAL(triggered()), this, SLOT(triangulatePointSet()));
+
     openTriangulationAct = new QAction(tr("Open Triangulation..."), this);
     openTriangulationAct->setStatusTip(tr("Open an existing weighted triangulation file"));
     connect(openTriangulationAct, SIGNAL(triggered()), this, SLOT(openTriangulation()));
@@ -153,10 +204,38 @@ void MainWindow::createActions()
     saveTriangulationAsAct->setStatusTip(tr("Save Triangulation to a file"));
     connect(saveTriangulationAsAct, SIGNAL(triggered()), this, SLOT(saveTriangulationAs()));
 
-    renderTriangulationEPSAct = new QAction(tr("&Render EPS..."), this);
-    renderTriangulationEPSAct->setShortcut(tr("Ctrl+R"));
-    renderTriangulationEPSAct->setStatusTip(tr("Render the map to an EPS file"));
-    connect(renderTriangulationEPSAct, SIGNAL(triggered()), this, SLOT(renderTriangulationEPS()));
+    renderTriangulationVectorAct = new QAction(tr("&Render Figure..."), this);
+    renderTriangulationVectorAct->setShortcut(tr("Ctrl+R"));
+    renderTriangulationVectorAct->setStatusTip(tr("Render the map to an EPS, SVG or PDF file"));
+    connect(renderTriangulationVectorAct, SIGNAL(triggered()), this, SLOT(renderTriangulationVector()));
+
+    renderTriangulationImageAct = new QAction(tr("Render &Image..."), this);
+    renderTriangulationImageAct->setShortcut(tr("Ctrl+I"));
+    renderTriangulationImageAct->setStatusTip(tr("Render the map to a PNG or TIFF image"));
+    connect(renderTriangulationImageAct, SIGNAL(triggered()), this, SLOT(renderTriangulationImage()));
+
+    dissolveRegionsAct = new QAction(tr("&Dissolve Regions"), this);
+    dissolveRegionsAct->setCheckable(true);
+    dissolveRegionsAct->setStatusTip(tr("Draw connected faces of equal weight as one region"));
+    connect(dissolveRegionsAct, SIGNAL(toggled(bool)), renderTriangulation, SLOT(setDissolveRegions(bool)));
+
+    showTimingsAct = new QAction(tr("Show &Timings"), this);
+    showTimingsAct->setCheckable(true);
+    showTimingsAct->setShortcut(tr("F12"));
+    showTimingsAct->setStatusTip(tr("Show how long loading, painting and the like took in the status bar"));
+    connect(showTimingsAct, SIGNAL(toggled(bool)), this, SLOT(showTimings(bool)));
+
+    saveTimingsAct = new QAction(tr("Save Timings..."), this);
+    saveTimingsAct->setStatusTip(tr("Save the timings and counters so far as JSON"));
+    connect(saveTimingsAct, SIGNAL(triggered()), this, SLOT(saveTimings()));
+
+    saveTraceAct = new QAction(tr("Save Trace..."), this);
+    saveTraceAct->setStatusTip(tr("Save the recent timings as a trace for chrome://tracing"));
+    connect(saveTraceAct, SIGNAL(triggered()), this, SLOT(saveTrace()));
+
+    resetTimingsAct = new QAction(tr("Reset Timings"), this);
+    resetTimingsAct->setStatusTip(tr("Forget the timings and counters so far"));
+    connect(resetTimingsAct, SIGNAL(triggered()), this, SLOT(resetTimings()));
 
     exitAct = new QAction(tr("E&xit"), this);
     exitAct->setShortcuts(QKeySequence::Quit);
@@ -171,12 +250,107 @@ void MainWindow::createMenus()
     fileMenu->addAction(openPointSetAct);
     fileMenu->addAction(savePointSetAsAct);
     fileMenu->addAction(addPointSetGridAct);
+    fileMenu->addAction(triangulatePointSetAct);
     fileMenu->addSeparator();
     fileMenu->addAction(openTriangulationAct);
     fileMenu->addAction(saveTriangulationAsAct);
-    fileMenu->addAction(renderTriangulationEPSAct);
+    fileMenu->addAction(renderTriangulationVectorAct);
+    fileMenu->addAction(renderTriangulationImageAct);
     fileMenu->addSeparator();
     fileMenu->addAction(exitAct);
+
+    QMenu *viewMenu = menuBar()->addMenu(tr("&View"));
+    viewMenu->addAction(dissolveRegionsAct);
+    viewMenu->addSeparator();
+    viewMenu->addAction(showTimingsAct);
+    viewMenu->addAction(saveTimingsAct);
+    viewMenu->addAction(saveTraceAct);
+    viewMenu->addAction(resetTimingsAct);
+}
+
+// Loading runs in the background, with its progress and a way to cancel it
+// in the status bar.
+void MainWindow::createStatusBar()
+{
+    loadProgressBar = new QProgressBar;
+    loadProgressBar->setRange(0, Progress::scale);
+    loadProgressBar->setMaximumWidth(200);
+    cancelLoadButton = new QPushButton(tr("Cancel"));
+    statusBar()->addPermanentWidget(loadProgressBar);
+    statusBar()->addPermanentWidget(cancelLoadButton);
+    setLoading(false);
+
+    Loader *loaders[] = { renderTriangulation->loader(),
+                          pointSetEditor->renderPointSet->loader() };
+    for (int i = 0; i < 2; i++) {
+        connect(loaders[i], SIGNAL(progressChanged(int)), loadProgressBar, SLOT(setValue(int)));
+        connect(loaders[i], SIGNAL(loadingChanged(bool)), this, SLOT(setLoading(bool)));
+    }
+    connect(cancelLoadButton, SIGNAL(clicked()), this, SLOT(cancelLoading()));
+
+    // The latest timings, refreshed while they are shown. The tooltip has
+    // all of them.
+    timingsLabel = new QLabel;
+    statusBar()->addWidget(timingsLabel, 1);
+    timingsTimer = new QTimer(this);
+    timingsTimer->setInterval(500);
+    connect(timingsTimer, SIGNAL(timeout()), this, SLOT(updateTimings()));
+    showTimings(false);
+}
+
+void MainWindow::setLoading(bool loading)
+{
+    loadProgressBar->setVisible(loading);
+    cancelLoadButton->setVisible(loading);
+}
+
+void MainWindow::cancelLoading()
+{
+    renderTriangulation->loader()->cancel();
+    pointSetEditor->renderPointSet->loader()->cancel();
+}
+
+void MainWindow::showTimings(bool show)
+{
+    timingsLabel->setVisible(show);
+    if (show) {
+        updateTimings();
+        timingsTimer->start();
+    } else {
+        timingsTimer->stop();
+    }
+}
+
+void MainWindow::updateTimings()
+{
+    timingsLabel->setText(perf_status(6));
+    timingsLabel->setToolTip(perf_summary().join("\n"));
+}
+
+void MainWindow::saveTimings()
+{
+    QString path = QFileDialog::getSaveFileName(
+        this, tr("Save Timings"), QString(), tr("JSON Files (*.json)"));
+
+    QString error;
+    if (!path.isEmpty() && !write_perf_json(path, &error))
+        qWarning() << error;
+}
+
+void MainWindow::saveTrace()
+{
+    QString path = QFileDialog::getSaveFileName(
+        this, tr("Save Trace"), QString(), tr("Chrome Trace Files (*.json)"));
+
+    QString error;
+    if (!path.isEmpty() && !write_perf_trace(path, &error))
+        qWarning() << error;
+}
+
+void MainWindow::resetTimings()
+{
+    perf_reset();
+    updateTimings();
 }
 
 void MainWindow::enablePointEditor()
@@ -195,6 +369,7 @@ void MainWindow::setPointEditorMode(bool enabled)
 {
     savePointSetAsAct->setEnabled(enabled);
     addPointSetGridAct->setEnabled(enabled);
+    triangulatePointSetAct->setEnabled(enabled);
     if (enabled)
         stackedLayout->setCurrentWidget(pointSetEditor);
 }
@@ -202,7 +377,9 @@ void MainWindow::setPointEditorMode(bool enabled)
 void MainWindow::setTriangulationEditorMode(bool enabled)
 {
     saveTriangulationAsAct->setEnabled(enabled);
-    renderTriangulationEPSAct->setEnabled(enabled);
+    renderTriangulationVectorAct->setEnabled(enabled);
+    renderTriangulationImageAct->setEnabled(enabled);
+    dissolveRegionsAct->setEnabled(enabled);
     if (enabled)
         stackedLayout->setCurrentWidget(renderTriangulation);
 }
@@ -4,6 +4,10 @@
 #include <QStackedLayout>
 
 class PointSetEditor;
+class QLabel;
+class QProgressBar;
+class QPushButton;
+class QTimer;
 class RenderTriangulation;
 
 class MainWindow : public QMainWindow
@@ -18,14 +22,26 @@ private slots:
     void openPointSet();
     void savePointSetAs();
     void addPointSetGrid();
+    void triangulatePointSet();
 
     void openTriangulation();
     void saveTriangulationAs();
-    void renderTriangulationEPS();
+    void renderTriangulationVector();
+    void renderTriangulationImage();
+
+    void setLoading(bool loading);
+    void cancelLoading();
+
+    void showTimings(bool show);
+    void updateTimings();
+    void saveTimings();
+    void saveTrace();
+    void resetTimings();
 
 private:
     void createActions();
     void createMenus();
+    void createStatusBar();
     void enablePointEditor();
     void enableTriangulationEditor();
     void setPointEditorMode(bool);
@@ -38,15 +54,26 @@ private:
     QAction *openPointSetAct;
     QAction *savePointSetAsAct;
     QAction *addPointSetGridAct;
+    QAction *triangulatePointSetAct;
 
     // Triangulation Editor
     RenderTriangulation *renderTriangulation;
     QString triangulation_path;
     QAction *openTriangulationAct;
     QAction *saveTriangulationAsAct;
-    QAction *renderTriangulationEPSAct;
+    QAction *renderTriangulationVectorAct;
+    QAction *renderTriangulationImageAct;
+    QAction *dissolveRegionsAct;
 
     // Misc
     QStackedLayout *stackedLayout;
+    QProgressBar *loadProgressBar;
+    QPushButton *cancelLoadButton;
+    QLabel *timingsLabel;
+    QTimer *timingsTimer;
+    QAction *showTimingsAct;
+    QAction *saveTimingsAct;
+    QAction *saveTraceAct;
+    QAction *resetTimingsAct;
     QAction *exitAct;
 };
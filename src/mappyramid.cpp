@@ -0,0 +1,489 @@
+#include "mappyramid.h"
+#include "predicates.h"
+#include "perf.h"
+
+#include <QHash>
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// About how many faces go in each block, enough to be worth a job of their
+// own while leaving plenty of jobs to share between cores.
+static const int block_faces = 32768;
+
+// A level is only kept if it has at most this fraction of the faces of the
+// one before, and no more levels are made once they are this small.
+static const qreal max_level_fraction = 0.7;
+static const int min_level_faces = 256;
+
+typedef TriangulatedMap::Face Face;
+
+namespace {
+
+// What the blocks of a pass share. Each block only writes the errors of
+// vertices whose faces are all in it, so no two blocks write the same one.
+struct Pass {
+    const QPointF *vertices;
+    const Face *faces;
+    // How many faces use each vertex.
+    const int *uses;
+    // How far the points of the map each vertex stands for may be from it.
+    qreal *errors;
+    qreal max_error;
+    // The vertices worth trying to move, or null for all of them.
+    const bool *active;
+    Progress *progress;
+};
+
+struct Block {
+    const Pass *pass;
+    QVector<int> faces;
+
+    QVector<Face> simplified;
+    // Whether some collapse was only held back by max_error.
+    bool held_back;
+};
+
+// Moving vertex v onto vertex a, leaving a's error at cost. Only the entry
+// with v's latest version counts.
+struct Collapse {
+    qreal cost;
+    int v, a;
+    int version;
+};
+
+bool cheaper(const Collapse &x, const Collapse &y)
+{
+    return x.cost < y.cost;
+}
+
+// Orders the heap cheapest first.
+bool costlier(const Collapse &x, const Collapse &y)
+{
+    return x.cost > y.cost;
+}
+
+// Simplifies the faces of one block, in local vertex numbers.
+class BlockSimplifier
+{
+public:
+    BlockSimplifier(Block &block);
+    void run();
+
+private:
+    QPointF position(int v) const { return pass.vertices[global[v]]; }
+    qreal error(int v) const { return pass.errors[global[v]]; }
+    qreal cost(int v, int a) const;
+
+    void neighbours(int v, QVector<int> &result, QVector<bool> *boundary = 0) const;
+    void targets(int v, QVector<int> &result) const;
+    bool canCollapse(int v, int a) const;
+    void collapse(int v, int a, qreal cost);
+    void queue(int v);
+    void removeFromStar(int v, int face);
+
+    Block &block;
+    const Pass &pass;
+
+    QVector<int> global;
+    QVector<Face> faces;
+    QVector<bool> alive;
+    // The faces using each vertex.
+    QVector<QVector<int> > star;
+    // Vertices also used by faces of other blocks.
+    QVector<bool> frozen;
+
+    // Each vertex is in the heap at most once, with its cheapest collapse.
+    QVector<Collapse> heap;
+    QVector<int> version;
+    QVector<bool> queued;
+
+    // Kept between calls to save allocating them each time.
+    mutable QVector<int> around, around_v, around_a, queue_targets;
+    QVector<Collapse> queue_candidates;
+    mutable QVector<bool> around_boundary;
+    mutable QVector<qreal> around_weight;
+};
+
+BlockSimplifier::BlockSimplifier(Block &block)
+    : block(block), pass(*block.pass)
+{
+    QHash<int, int> local;
+    faces.reserve(block.faces.size());
+    foreach(int i, block.faces) {
+        Face face = pass.faces[i];
+        for (int j = 0; j < 3; j++) {
+            int id = local.value(face.v[j], -1);
+            if (id == -1) {
+                id = global.size();
+                local.insert(face.v[j], id);
+                global.append(face.v[j]);
+                star.append(QVector<int>());
+            }
+            face.v[j] = id;
+            star[id].append(faces.size());
+        }
+        faces.append(face);
+    }
+    alive.fill(true, faces.size());
+
+    frozen.resize(global.size());
+    for (int v = 0; v < global.size(); v++)
+        frozen[v] = star[v].size() != pass.uses[global[v]];
+    version.fill(0, global.size());
+    queued.fill(false, global.size());
+}
+
+qreal BlockSimplifier::cost(int v, int a) const
+{
+    QPointF d = position(v) - position(a);
+    return qMax(error(a), error(v) + std::sqrt(d.x() * d.x() + d.y() * d.y()));
+}
+
+// Fills result with the vertices sharing an edge with v. Given boundary,
+// also says for each whether that edge is on a boundary: with a face on
+// just one side, or faces of different weights on its two sides.
+void BlockSimplifier::neighbours(int v, QVector<int> &result, QVector<bool> *boundary) const
+{
+    result.clear();
+    if (boundary) {
+        boundary->clear();
+        around_weight.clear();
+    }
+    const QVector<int> &faces_of_v = star[v];
+    for (int k = 0; k < faces_of_v.size(); k++) {
+        const Face &face = faces[faces_of_v[k]];
+        for (int j = 0; j < 3; j++) {
+            int w = face.v[j];
+            if (w == v)
+                continue;
+            int i = result.indexOf(w);
+            if (i == -1) {
+                result.append(w);
+                if (boundary) {
+                    // One side so far.
+                    boundary->append(true);
+                    around_weight.append(face.weight);
+                }
+            } else if (boundary) {
+                (*boundary)[i] = face.weight != around_weight[i];
+            }
+        }
+    }
+}
+
+// The vertices v may be moved onto without changing any region.
+void BlockSimplifier::targets(int v, QVector<int> &result) const
+{
+    result.clear();
+    if (frozen[v] || star[v].empty())
+        return;
+
+    neighbours(v, around, &around_boundary);
+    int n_boundary = around_boundary.count(true);
+    if (n_boundary != 0 && n_boundary != 2)
+        return;
+    for (int i = 0; i < around.size(); i++) {
+        if (!frozen[around[i]] && (n_boundary == 0 || around_boundary[i]))
+            result.append(around[i]);
+    }
+}
+
+bool BlockSimplifier::canCollapse(int v, int a) const
+{
+    // The vertices next to both must be just the far corners of the faces
+    // on the edge between them, or the collapse would pinch the mesh.
+    const QVector<int> &faces_of_v = star[v];
+    int shared_faces = 0;
+    for (int k = 0; k < faces_of_v.size(); k++) {
+        const Face &face = faces[faces_of_v[k]];
+        if (face.v[0] == a || face.v[1] == a || face.v[2] == a)
+            shared_faces++;
+    }
+    neighbours(v, around_v);
+    neighbours(a, around_a);
+    int shared_neighbours = 0;
+    for (int k = 0; k < around_v.size(); k++) {
+        if (around_a.contains(around_v[k]))
+            shared_neighbours++;
+    }
+    if (shared_neighbours != shared_faces)
+        return false;
+
+    // No face that stays may flip over or flatten.
+    for (int k = 0; k < faces_of_v.size(); k++) {
+        const Face &face = faces[faces_of_v[k]];
+        QPointF before[3], after[3];
+        bool has_a = false;
+        for (int j = 0; j < 3; j++) {
+            before[j] = position(face.v[j]);
+            after[j] = face.v[j] == v ? position(a) : before[j];
+            has_a = has_a || face.v[j] == a;
+        }
+        if (has_a)
+            continue;
+        int sign_after = sign(orient2d(after[0], after[1], after[2]));
+        if (sign_after == 0 || sign_after != sign(orient2d(before[0], before[1], before[2])))
+            return false;
+    }
+    return true;
+}
+
+void BlockSimplifier::removeFromStar(int v, int face)
+{
+    QVector<int> &faces_of_v = star[v];
+    int i = faces_of_v.indexOf(face);
+    faces_of_v[i] = faces_of_v.last();
+    faces_of_v.resize(faces_of_v.size() - 1);
+}
+
+void BlockSimplifier::collapse(int v, int a, qreal cost)
+{
+    const QVector<int> &faces_of_v = star[v];
+    for (int k = 0; k < faces_of_v.size(); k++) {
+        int f = faces_of_v[k];
+        Face &face = faces[f];
+        if (face.v[0] == a || face.v[1] == a || face.v[2] == a) {
+            alive[f] = false;
+            for (int j = 0; j < 3; j++) {
+                if (face.v[j] != v)
+                    removeFromStar(face.v[j], f);
+            }
+        } else {
+            for (int j = 0; j < 3; j++) {
+                if (face.v[j] == v)
+                    face.v[j] = a;
+            }
+            star[a].append(f);
+        }
+    }
+    star[v].clear();
+    pass.errors[global[a]] = cost;
+}
+
+// Puts v in the heap with the cheapest collapse it can make now, if any,
+// replacing what it had there before.
+void BlockSimplifier::queue(int v)
+{
+    version[v]++;
+    queued[v] = false;
+    targets(v, queue_targets);
+
+    // Check the cheapest first, as most collapses that pass the other
+    // tests are fine.
+    queue_candidates.clear();
+    foreach(int a, queue_targets) {
+        Collapse candidate = { cost(v, a), v, a, version[v] };
+        if (candidate.cost > pass.max_error)
+            block.held_back = true;
+        else
+            queue_candidates.append(candidate);
+    }
+    std::sort(queue_candidates.begin(), queue_candidates.end(), cheaper);
+    foreach(const Collapse &candidate, queue_candidates) {
+        if (canCollapse(v, candidate.a)) {
+            heap.append(candidate);
+            std::push_heap(heap.begin(), heap.end(), costlier);
+            queued[v] = true;
+            return;
+        }
+    }
+}
+
+void BlockSimplifier::run()
+{
+    for (int v = 0; v < global.size(); v++) {
+        if (!pass.active || pass.active[global[v]])
+            queue(v);
+    }
+
+    // A collapse can spoil or make dearer the collapses queued around it, so
+    // each is checked again as it comes up, and its vertex queued afresh if
+    // it no longer holds. Vertices around it with nothing queued may have
+    // been given something they can do.
+    QVector<int> result;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), costlier);
+        Collapse candidate = heap.last();
+        heap.resize(heap.size() - 1);
+
+        int v = candidate.v, a = candidate.a;
+        if (candidate.version != version[v])
+            continue;
+        queued[v] = false;
+        targets(v, result);
+        if (!result.contains(a) || cost(v, a) != candidate.cost || !canCollapse(v, a)) {
+            queue(v);
+            continue;
+        }
+
+        collapse(v, a, candidate.cost);
+        if (!queued[a])
+            queue(a);
+        neighbours(a, result);
+        foreach(int w, result) {
+            if (!queued[w])
+                queue(w);
+        }
+    }
+
+    for (int f = 0; f < faces.size(); f++) {
+        if (!alive[f])
+            continue;
+        Face face = faces[f];
+        for (int j = 0; j < 3; j++)
+            face.v[j] = global[face.v[j]];
+        block.simplified.append(face);
+    }
+}
+
+void simplify_block(Block &block)
+{
+    // The pass is thrown away once canceled, so there's no need to finish.
+    if (block.pass->progress && block.pass->progress->isCanceled())
+        return;
+    BlockSimplifier simplifier(block);
+    simplifier.run();
+}
+
+}
+
+// Collapses what edges of faces it can within pass.max_error, with the
+// faces split into blocks of about block_side across, shifted by shift.
+// Sets seams for the vertices left on the edges between blocks. Returns
+// whether any collapse was held back by max_error.
+static bool simplify(const TMapWrapper &tmap_wrapper, Pass &pass, QVector<Face> &faces,
+                     qreal block_side, qreal shift, QVector<bool> &seams)
+{
+    const QVector<QPointF> &vertices = tmap_wrapper.tmap.vertices;
+    QVector<int> uses(vertices.size(), 0);
+    foreach(const Face &face, faces) {
+        for (int j = 0; j < 3; j++)
+            uses[face.v[j]]++;
+    }
+    pass.faces = faces.constData();
+    pass.uses = uses.constData();
+
+    // A face belongs to the block holding its centroid.
+    int cols = int((tmap_wrapper.xrange + shift) / block_side) + 1;
+    int rows = int((tmap_wrapper.yrange + shift) / block_side) + 1;
+    QVector<Block> blocks(cols * rows);
+    for (int i = 0; i < blocks.size(); i++) {
+        blocks[i].pass = &pass;
+        blocks[i].held_back = false;
+    }
+    QVector<int> vertex_block(vertices.size(), -1);
+    seams.fill(false, vertices.size());
+    for (int i = 0; i < faces.size(); i++) {
+        const Face &face = faces[i];
+        QPointF centroid = (vertices[face.v[0]] + vertices[face.v[1]] + vertices[face.v[2]]) / 3;
+        int col = qBound(0, int((centroid.x() - tmap_wrapper.xmin + shift) / block_side), cols - 1);
+        int row = qBound(0, int((centroid.y() - tmap_wrapper.ymin + shift) / block_side), rows - 1);
+        int block = row * cols + col;
+        blocks[block].faces.append(i);
+        for (int j = 0; j < 3; j++) {
+            int &b = vertex_block[face.v[j]];
+            if (b != -1 && b != block)
+                seams[face.v[j]] = true;
+            b = block;
+        }
+    }
+
+    if (blocks.size() == 1)
+        simplify_block(blocks[0]);
+    else
+        QtConcurrent::blockingMap(blocks, simplify_block);
+
+    QVector<Face> simplified;
+    bool held_back = false;
+    foreach(const Block &block, blocks) {
+        simplified += block.simplified;
+        held_back = held_back || block.held_back;
+    }
+    faces = simplified;
+    return held_back;
+}
+
+void MapPyramid::clear()
+{
+    levels.clear();
+}
+
+void MapPyramid::build(const TMapWrapper &tmap_wrapper, Progress *progress)
+{
+    clear();
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    if (tmap.faces.size() < min_level_faces)
+        return;
+    PerfScope scope("build_map_pyramid");
+
+    QVector<qreal> errors(tmap.vertices.size(), 0);
+    Pass pass;
+    pass.vertices = tmap.vertices.constData();
+    pass.errors = errors.data();
+    pass.progress = progress;
+    QVector<bool> seams, near_seams;
+
+    // The first level allows errors of about twice the spacing of the
+    // vertices, and each one after twice that of the last.
+    qreal area = qMax(tmap_wrapper.xrange * tmap_wrapper.yrange,
+                      std::numeric_limits<qreal>::min());
+    qreal diagonal = std::sqrt(tmap_wrapper.xrange * tmap_wrapper.xrange +
+                               tmap_wrapper.yrange * tmap_wrapper.yrange);
+    pass.max_error = std::sqrt(area / tmap.faces.size());
+
+    QVector<Face> faces = tmap.faces;
+    int last_kept = faces.size();
+    while (faces.size() >= min_level_faces && pass.max_error < diagonal) {
+        int faces_before = faces.size();
+        pass.max_error *= 2;
+        qreal block_side = std::sqrt(area * block_faces / faces.size());
+        pass.active = 0;
+        bool held_back = simplify(tmap_wrapper, pass, faces, block_side, 0, seams);
+
+        // Only the vertices on and next to the seams of the first pass have
+        // anything new to try in the second.
+        near_seams.fill(false, tmap.vertices.size());
+        foreach(const Face &face, faces) {
+            if (seams[face.v[0]] || seams[face.v[1]] || seams[face.v[2]])
+                near_seams[face.v[0]] = near_seams[face.v[1]] = near_seams[face.v[2]] = true;
+        }
+        pass.active = near_seams.constData();
+        held_back = simplify(tmap_wrapper, pass, faces, block_side, block_side / 2, seams) ||
+                    held_back;
+        if (progress && progress->isCanceled()) {
+            clear();
+            return;
+        }
+        // Most of the work goes on the faces taken out, which add up to
+        // about all of them by the end.
+        if (progress)
+            progress->advance(faces_before - faces.size(), tmap.faces.size());
+
+        if (faces.size() <= max_level_fraction * last_kept) {
+            Level level;
+            level.error = 0;
+            foreach(qreal error, errors)
+                level.error = qMax(level.error, error);
+            level.tmap.vertices = tmap.vertices;
+            level.tmap.faces = faces;
+            level.grid.build(level.tmap);
+            levels.append(level);
+            last_kept = faces.size();
+        }
+
+        // Nothing more will collapse however large the errors allowed.
+        if (!held_back)
+            break;
+    }
+}
+
+const MapPyramid::Level *MapPyramid::level(qreal max_error) const
+{
+    for (int i = levels.size() - 1; i >= 0; i--) {
+        if (levels[i].error < max_error)
+            return &levels[i];
+    }
+    return 0;
+}
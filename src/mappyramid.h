@@ -0,0 +1,49 @@
+#pragma once
+
+#include "tmapwrapper.h"
+#include "progress.h"
+
+#include <QVector>
+
+// Coarser versions of a map, for drawing it when most of its faces would be
+// under a pixel. Each level is made from the one before by collapsing edges:
+// moving a vertex onto a neighbour and dropping the faces between them. A
+// level's error is how far any point of the map may have moved, and it about
+// doubles from one level to the next.
+//
+// Collapses never cross a boundary between faces of different weights. A
+// vertex only moves if its faces all have the same weight, or if it has just
+// two edges on boundaries, in which case it moves along one of them. So each
+// level has every region of the map, with its outline off by no more than
+// the error.
+//
+// The faces are split into blocks by position, which are simplified in
+// parallel. Vertices shared with other blocks stay put, so each level takes
+// a second pass with the blocks shifted by half to give them their turn.
+//
+// Building takes a few seconds for a map of a million faces, so it is done
+// on a worker thread, and the map is drawn in full until it is ready.
+class MapPyramid
+{
+public:
+    struct Level {
+        qreal error;
+        // Shares its vertices with the map.
+        TriangulatedMap tmap;
+        FaceGrid grid;
+    };
+
+    // Leaves the pyramid empty if canceled part way through.
+    void build(const TMapWrapper &tmap_wrapper, Progress *progress = 0);
+    void clear();
+
+    // The coarsest level with an error under max_error, or null if there is
+    // none and the map itself has to be drawn.
+    const Level *level(qreal max_error) const;
+
+    int levelCount() const { return levels.size(); }
+
+private:
+    // Finest first.
+    QVector<Level> levels;
+};
@@ -0,0 +1,184 @@
+#include <QtGui>
+
+#include "maprenderer.h"
+#include "facebatches.h"
+#include "faceregions.h"
+#include "mappyramid.h"
+#include "rasterizer.h"
+#include "perf.h"
+
+static const float image_margin = 5;
+
+// Below this many pixels per face on average, drawing faces one at a time
+// and collapsing those under a pixel beats drawing the batches.
+static const qreal min_batched_face_area = 4;
+
+// How far in pixels a level of the pyramid may be off for it to be drawn
+// in place of the map.
+static const qreal max_pixel_error = 1;
+
+int grey_level(const TMapWrapper &tmap_wrapper, qreal weight)
+{
+    int grey_intensity = 255 * (tmap_wrapper.max_weight - weight) / tmap_wrapper.max_weight;
+    return qBound(0, grey_intensity, 255);
+}
+
+RenderInfo calc_render_info(const TMapWrapper &tmap_wrapper, QPaintDevice *device, float margin)
+{
+    RenderInfo ri;
+    ri.scale = std::min(float(device->width()  - margin * 2) / tmap_wrapper.xrange,
+                        float(device->height() - margin * 2) / tmap_wrapper.yrange);
+    ri.xoffset = (device->width()  - tmap_wrapper.xrange * ri.scale) / 2;
+    ri.yoffset = (device->height() - tmap_wrapper.yrange * ri.scale) / 2;
+    return ri;
+}
+
+void render_map(QPaintDevice *device, const TMapWrapper &tmap_wrapper, const RenderInfo &ri,
+                const QRect &exposed, FaceBatches *batches, FaceRegions *regions,
+                const MapPyramid *pyramid)
+{
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    if (tmap.faces.empty() || exposed.isEmpty())
+        return;
+    PerfScope scope("render_map");
+
+    // The part of the map under the exposed rect, with a pixel to spare for
+    // the outlines and antialiasing.
+    QRectF visible((exposed.left() - 1 - ri.xoffset) / ri.scale + tmap_wrapper.xmin,
+                   (exposed.top() - 1 - ri.yoffset) / ri.scale + tmap_wrapper.ymin,
+                   (exposed.width() + 2) / ri.scale,
+                   (exposed.height() + 2) / ri.scale);
+
+    QPainter painter(device);
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setClipRect(exposed);
+
+    QColor color(0, 127, 0);
+    QPen pen(color);
+    painter.setPen(pen);
+
+    qreal face_area = tmap_wrapper.xrange * tmap_wrapper.yrange * ri.scale * ri.scale / tmap.faces.size();
+    if (regions || (batches && face_area >= min_batched_face_area)) {
+        // The pen has width 0, so it stays one pixel wide under the scaling.
+        painter.translate(ri.xoffset, ri.yoffset);
+        painter.scale(ri.scale, ri.scale);
+        painter.translate(-tmap_wrapper.xmin, -tmap_wrapper.ymin);
+        if (regions)
+            regions->draw(painter, tmap_wrapper, visible);
+        else
+            batches->draw(painter, tmap_wrapper, visible);
+        return;
+    }
+
+    const MapPyramid::Level *level = pyramid ? pyramid->level(max_pixel_error / ri.scale) : 0;
+    const TriangulatedMap &drawn = level ? level->tmap : tmap;
+    const FaceGrid &grid = level ? level->grid : tmap_wrapper.grid;
+
+    bool all_visible = visible.contains(QRectF(tmap_wrapper.xmin, tmap_wrapper.ymin,
+                                               tmap_wrapper.xrange, tmap_wrapper.yrange));
+    QVector<int> visible_faces;
+    if (!all_visible) {
+        // Draw in the same order as for the whole map, so where outlines
+        // overlap, rendering part of the map gives the same pixels.
+        grid.facesInRect(drawn, visible, visible_faces);
+        qSort(visible_faces);
+    }
+    int n_faces = all_visible ? drawn.faces.size() : visible_faces.size();
+    perf_count("faces_rendered", n_faces);
+
+    QPointF corner[3];
+    QPoint triangle[3];
+
+    // Pixels of the exposed rect a collapsed face has been drawn to.
+    QVector<bool> covered;
+    int brush_grey = -1;
+
+    for (int k = 0; k < n_faces; k++) {
+        const TriangulatedMap::Face &face = drawn.faces[all_visible ? k : visible_faces[k]];
+        int grey = grey_level(tmap_wrapper, face.weight);
+        QColor color(grey, grey, grey);
+
+        for (int i = 0; i < 3; i++) {
+            const QPointF &v = drawn.vertices[face.v[i]];
+            corner[i].setX((v.x() - tmap_wrapper.xmin) * ri.scale + ri.xoffset);
+            corner[i].setY((v.y() - tmap_wrapper.ymin) * ri.scale + ri.yoffset);
+        }
+
+        qreal left = qMin(corner[0].x(), qMin(corner[1].x(), corner[2].x()));
+        qreal right = qMax(corner[0].x(), qMax(corner[1].x(), corner[2].x()));
+        qreal top = qMin(corner[0].y(), qMin(corner[1].y(), corner[2].y()));
+        qreal bottom = qMax(corner[0].y(), qMax(corner[1].y(), corner[2].y()));
+        if (right - left < 1 && bottom - top < 1) {
+            int x = int(std::floor((left + right) / 2));
+            int y = int(std::floor((top + bottom) / 2));
+            if (!exposed.contains(x, y))
+                continue;
+            if (covered.empty())
+                covered.fill(false, exposed.width() * exposed.height());
+            int pixel = (y - exposed.top()) * exposed.width() + (x - exposed.left());
+            if (covered[pixel])
+                continue;
+            covered[pixel] = true;
+            painter.fillRect(x, y, 1, 1, color);
+            continue;
+        }
+
+        if (grey != brush_grey) {
+            painter.setBrush(QBrush(color));
+            brush_grey = grey;
+        }
+        for (int i = 0; i < 3; i++)
+            triangle[i] = corner[i].toPoint();
+        painter.drawConvexPolygon(triangle, 3);
+    }
+}
+
+void render_preview(QPaintDevice *device, const TMapWrapper &tmap_wrapper, const RenderInfo &ri,
+                    const QRect &exposed, int step)
+{
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    if (tmap.faces.empty() || exposed.isEmpty())
+        return;
+    PerfScope scope("render_preview");
+
+    int cols = (exposed.width() + step - 1) / step;
+    int rows = (exposed.height() + step - 1) / step;
+    QImage samples(cols, rows, QImage::Format_ARGB32_Premultiplied);
+    samples.fill(0);
+    for (int row = 0; row < rows; row++) {
+        QRgb *line = reinterpret_cast<QRgb *>(samples.scanLine(row));
+        qreal y = (exposed.top() + (row + 0.5) * step - ri.yoffset) / ri.scale + tmap_wrapper.ymin;
+        for (int col = 0; col < cols; col++) {
+            qreal x = (exposed.left() + (col + 0.5) * step - ri.xoffset) / ri.scale + tmap_wrapper.xmin;
+            int face = tmap_wrapper.grid.faceContaining(tmap, QPointF(x, y));
+            if (face == -1)
+                continue;
+            int grey = grey_level(tmap_wrapper, tmap.faces[face].weight);
+            line[col] = qRgb(grey, grey, grey);
+        }
+    }
+
+    QPainter painter(device);
+    painter.setClipRect(exposed);
+    painter.drawImage(QRect(exposed.topLeft(), QSize(cols * step, rows * step)), samples);
+}
+
+void render_map(QPaintDevice *device, const TMapWrapper &tmap_wrapper, float margin)
+{
+    render_map(device, tmap_wrapper, calc_render_info(tmap_wrapper, device, margin),
+               QRect(0, 0, device->width(), device->height()));
+}
+
+bool render_image(const QString &path, const TMapWrapper &tmap_wrapper, int max_size)
+{
+    if (tmap_wrapper.tmap.faces.empty())
+        return false;
+
+    QSizeF size(tmap_wrapper.xrange, tmap_wrapper.yrange);
+    size.scale(max_size, max_size, Qt::KeepAspectRatio);
+
+    QImage image = rasterize_map(tmap_wrapper,
+                                 QSize(qMax(1, qRound(size.width())), qMax(1, qRound(size.height()))),
+                                 image_margin);
+    return !image.isNull() && image.save(path);
+}
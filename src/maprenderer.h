@@ -0,0 +1,53 @@
+#pragma once
+
+#include "tmapwrapper.h"
+
+class FaceBatches;
+class FaceRegions;
+class MapPyramid;
+
+#include <QPaintDevice>
+#include <QRect>
+#include <QString>
+
+// Where a map is drawn on a paint device. A point p of the map is drawn at
+// ((p.x() - xmin) * scale + xoffset, (p.y() - ymin) * scale + yoffset).
+struct RenderInfo {
+    qreal scale, xoffset, yoffset;
+};
+
+// The grey a face of the given weight is drawn in, from 255 for a weight of
+// 0 down to 0 for the heaviest.
+int grey_level(const TMapWrapper &, qreal weight);
+
+// Fits the map to the device, leaving margin points around it.
+RenderInfo calc_render_info(const TMapWrapper &, QPaintDevice *device, float margin);
+
+// Draws the faces of the map overlapping the exposed rect of the device,
+// found through the face grid when the rect shows only part of the map.
+// Faces smaller than a pixel are collapsed to that pixel, and only the first
+// to land on each pixel is drawn.
+//
+// Given batches built for the map, faces big enough on screen are drawn
+// from those instead, a grey level at a time. Given regions, the map is
+// drawn dissolved into them. Given a pyramid, faces too small to make out
+// are drawn from its coarsest level that is off by less than a pixel.
+void render_map(QPaintDevice *device, const TMapWrapper &, const RenderInfo &ri,
+                const QRect &exposed, FaceBatches *batches = 0,
+                FaceRegions *regions = 0, const MapPyramid *pyramid = 0);
+
+// Quickly draws a blocky preview of the map over the exposed rect, each
+// step by step block of pixels in the grey of the face under its centre.
+// The faces are found through the face grid, so the time taken depends on
+// the size of the rect rather than the number of faces in it. Blocks off
+// the map are left as they were.
+void render_preview(QPaintDevice *device, const TMapWrapper &, const RenderInfo &ri,
+                    const QRect &exposed, int step);
+
+// Draws the whole map fitted to the device.
+void render_map(QPaintDevice *device, const TMapWrapper &, float margin);
+
+// Renders the map through rasterize_map to a grey image of at most max_size
+// pixels in any format QImage can write. Vector formats are written by
+// write_vector.
+bool render_image(const QString &path, const TMapWrapper &, int max_size);
@@ -0,0 +1,222 @@
+#include "perf.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+#include <cstdio>
+
+// The trace keeps this many of the most recent scopes.
+static const int max_events = 1 << 16;
+
+namespace {
+
+struct Event {
+    const char *name;
+    qint64 start, duration;
+    int thread;
+};
+
+struct Timing {
+    qint64 calls;
+    qint64 total, longest, last;
+    // When the last call ended, to order the status line.
+    qint64 last_end;
+};
+
+struct PerfLog {
+    PerfLog() : n_events(0) { clock.start(); }
+
+    QMutex mutex;
+    QElapsedTimer clock;
+    QMap<QByteArray, Timing> timings;
+    QMap<QByteArray, qint64> counters;
+
+    // The events in the order they ended, as a ring once it is full.
+    QVector<Event> events;
+    qint64 n_events;
+
+    // Small numbers for the threads, in the order they first recorded.
+    QHash<Qt::HANDLE, int> threads;
+};
+
+}
+
+static PerfLog perf_log;
+
+PerfScope::PerfScope(const char *name)
+    : name(name), start(perf_log.clock.nsecsElapsed())
+{
+}
+
+PerfScope::~PerfScope()
+{
+    qint64 end = perf_log.clock.nsecsElapsed();
+    qint64 duration = end - start;
+
+    QMutexLocker lock(&perf_log.mutex);
+    Timing &timing = perf_log.timings[QByteArray(name)];
+    timing.calls++;
+    timing.total += duration;
+    timing.longest = qMax(timing.longest, duration);
+    timing.last = duration;
+    timing.last_end = end;
+
+    Qt::HANDLE id = QThread::currentThreadId();
+    if (!perf_log.threads.contains(id))
+        perf_log.threads.insert(id, perf_log.threads.size() + 1);
+
+    Event event = { name, start, duration, perf_log.threads.value(id) };
+    if (perf_log.events.size() < max_events)
+        perf_log.events.append(event);
+    else
+        perf_log.events[int(perf_log.n_events % max_events)] = event;
+    perf_log.n_events++;
+}
+
+void perf_count(const char *name, qint64 amount)
+{
+    QMutexLocker lock(&perf_log.mutex);
+    perf_log.counters[QByteArray(name)] += amount;
+}
+
+void perf_reset()
+{
+    QMutexLocker lock(&perf_log.mutex);
+    perf_log.timings.clear();
+    perf_log.counters.clear();
+    perf_log.events.clear();
+    perf_log.n_events = 0;
+}
+
+static QString format_duration(qint64 ns)
+{
+    if (ns < 10000)
+        return QString("%1 us").arg(ns / 1e3, 0, 'f', 1);
+    if (ns < 10000000)
+        return QString("%1 ms").arg(ns / 1e6, 0, 'f', 2);
+    if (ns < 10000000000ll)
+        return QString("%1 ms").arg(ns / 1e6, 0, 'f', 0);
+    return QString("%1 s").arg(ns / 1e9, 0, 'f', 1);
+}
+
+QStringList perf_summary()
+{
+    QMutexLocker lock(&perf_log.mutex);
+    QStringList lines;
+    QMap<QByteArray, Timing>::const_iterator t;
+    for (t = perf_log.timings.constBegin(); t != perf_log.timings.constEnd(); ++t) {
+        const Timing &timing = t.value();
+        lines << QString("%1: last %2, mean %3, max %4, %5 calls")
+            .arg(QString(t.key()))
+            .arg(format_duration(timing.last))
+            .arg(format_duration(timing.total / timing.calls))
+            .arg(format_duration(timing.longest))
+            .arg(timing.calls);
+    }
+    QMap<QByteArray, qint64>::const_iterator c;
+    for (c = perf_log.counters.constBegin(); c != perf_log.counters.constEnd(); ++c)
+        lines << QString("%1: %2").arg(QString(c.key())).arg(c.value());
+    return lines;
+}
+
+QString perf_status(int n)
+{
+    QMutexLocker lock(&perf_log.mutex);
+
+    // Timings are few, so picking out the latest each time is cheap.
+    QMap<qint64, QByteArray> by_end;
+    QMap<QByteArray, Timing>::const_iterator t;
+    for (t = perf_log.timings.constBegin(); t != perf_log.timings.constEnd(); ++t)
+        by_end.insertMulti(-t.value().last_end, t.key());
+
+    QStringList parts;
+    QMap<qint64, QByteArray>::const_iterator e;
+    for (e = by_end.constBegin(); e != by_end.constEnd() && parts.size() < n; ++e) {
+        parts << QString("%1 %2").arg(QString(e.value()))
+                                 .arg(format_duration(perf_log.timings.value(e.value()).last));
+    }
+    return parts.join("   ");
+}
+
+static bool write_text(const QString &path, const QByteArray &text, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text) ||
+        file.write(text) != text.size()) {
+        if (error)
+            *error = QString("%1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+    return true;
+}
+
+// Times in the JSON are in microseconds, as the trace format has them.
+static QByteArray microseconds(qint64 ns)
+{
+    char text[32];
+    sprintf(text, "%.3f", ns / 1e3);
+    return text;
+}
+
+bool write_perf_json(const QString &path, QString *error)
+{
+    QByteArray json = "{\n  \"timings\": {";
+    {
+        QMutexLocker lock(&perf_log.mutex);
+        QMap<QByteArray, Timing>::const_iterator t;
+        for (t = perf_log.timings.constBegin(); t != perf_log.timings.constEnd(); ++t) {
+            const Timing &timing = t.value();
+            json += t == perf_log.timings.constBegin() ? "\n" : ",\n";
+            json += "    \"" + t.key() + "\": {\"calls\": " + QByteArray::number(timing.calls) +
+                    ", \"total_us\": " + microseconds(timing.total) +
+                    ", \"mean_us\": " + microseconds(timing.total / timing.calls) +
+                    ", \"max_us\": " + microseconds(timing.longest) +
+                    ", \"last_us\": " + microseconds(timing.last) + "}";
+        }
+        json += "\n  },\n  \"counters\": {";
+        QMap<QByteArray, qint64>::const_iterator c;
+        for (c = perf_log.counters.constBegin(); c != perf_log.counters.constEnd(); ++c) {
+            json += c == perf_log.counters.constBegin() ? "\n" : ",\n";
+            json += "    \"" + c.key() + "\": " + QByteArray::number(c.value());
+        }
+        json += "\n  }\n}\n";
+    }
+    return write_text(path, json, error);
+}
+
+bool write_perf_trace(const QString &path, QString *error)
+{
+    QByteArray json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    {
+        QMutexLocker lock(&perf_log.mutex);
+        const QVector<Event> &events = perf_log.events;
+        int first = perf_log.n_events > max_events ? int(perf_log.n_events % max_events) : 0;
+        qint64 end = 0;
+        for (int i = 0; i < events.size(); i++) {
+            const Event &event = events[(first + i) % events.size()];
+            json += "{\"name\": \"" + QByteArray(event.name) +
+                    "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " + QByteArray::number(event.thread) +
+                    ", \"ts\": " + microseconds(event.start) +
+                    ", \"dur\": " + microseconds(event.duration) + "},\n";
+            end = qMax(end, event.start + event.duration);
+        }
+
+        QMap<QByteArray, qint64>::const_iterator c;
+        for (c = perf_log.counters.constBegin(); c != perf_log.counters.constEnd(); ++c) {
+            json += "{\"name\": \"" + c.key() + "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " +
+                    microseconds(end) + ", \"args\": {\"value\": " +
+                    QByteArray::number(c.value()) + "}},\n";
+        }
+    }
+    // Chrome accepts the last comma, but strict JSON readers do not.
+    if (json.endsWith(",\n"))
+        json.chop(2);
+    json += "\n]}\n";
+    return write_text(path, json, error);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QtGlobal>
+
+// Timers and counters that stay in release builds, to see where the time
+// goes on a map without a profiler. A PerfScope times the block it is
+// declared in under its name, which adds to the calls, total, longest and
+// last time kept for that name, and to a trace of the most recent scopes.
+// Counters add up amounts such as bytes read or faces drawn.
+//
+// Everything is safe to use from any thread. Recording takes a lock, so
+// scopes go around whole operations, such as loading a file or painting,
+// rather than inside their loops.
+
+class PerfScope
+{
+public:
+    // The name must stay valid for as long as the program runs, as a string
+    // literal does.
+    explicit PerfScope(const char *name);
+    ~PerfScope();
+
+private:
+    const char *name;
+    qint64 start;
+};
+
+void perf_count(const char *name, qint64 amount = 1);
+
+// Forgets every timing, counter and trace event so far.
+void perf_reset();
+
+// A line for each timing and then each counter, for showing in full.
+QStringList perf_summary();
+
+// The last time of the n timings that ended most recently, latest first,
+// for a status bar.
+QString perf_status(int n);
+
+// Writes the timings and counters as JSON.
+bool write_perf_json(const QString &path, QString *error = 0);
+
+// Writes the recent scopes as a trace that chrome://tracing and Perfetto
+// can open, with the counters at their final values.
+bool write_perf_trace(const QString &path, QString *error = 0);
@@ -0,0 +1,216 @@
+#include "pointlocator.h"
+#include "predicates.h"
+#include "perf.h"
+
+#include <QtConcurrentMap>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+static const int chunk_size = 16384;
+
+// The corners of every face, one array per coordinate.
+struct FaceCorners {
+    QVector<qreal> ax, ay, bx, by, cx, cy;
+};
+
+struct LocateChunk {
+    const FaceGrid *grid;
+    const FaceCorners *corners;
+    const QPointF *points;
+    int *faces;
+    int n;
+    bool use_avx2;
+};
+
+// Whether p is in face f, worked out as CompGeom::point_in_face does. The
+// predicates are exact, so the answers match.
+static inline bool in_face(const FaceCorners &c, int f, const QPointF &p)
+{
+    QPointF a(c.ax[f], c.ay[f]), b(c.bx[f], c.by[f]), d(c.cx[f], c.cy[f]);
+    int side1 = sign(orient2d(p, a, b));
+    int side2 = sign(orient2d(p, b, d));
+    int side3 = sign(orient2d(p, d, a));
+    return side1 == side2 && side2 == side3;
+}
+
+static void locate_chunk_scalar(const LocateChunk &chunk)
+{
+    for (int q = 0; q < chunk.n; q++) {
+        const int *begin, *end;
+        chunk.grid->candidateFaces(chunk.points[q], begin, end);
+        chunk.faces[q] = -1;
+        for (const int *i = begin; i != end; ++i) {
+            if (in_face(*chunk.corners, *i, chunk.points[q])) {
+                chunk.faces[q] = *i;
+                break;
+            }
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+
+// Sets pos, zero and neg to the lanes where the line through a and b, with
+// p at the origin, has p on its left, on it and on its right. This is the
+// floating point filter of orient2d, so unsure is set to the lanes too
+// close to call, which need the exact test.
+__attribute__((target("avx2")))
+static inline void sides_avx2(__m256d ax, __m256d ay, __m256d bx, __m256d by,
+                              __m256d &pos, __m256d &zero, __m256d &neg,
+                              __m256d &unsure)
+{
+    const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    __m256d left = _mm256_mul_pd(ax, by);
+    __m256d right = _mm256_mul_pd(ay, bx);
+    __m256d det = _mm256_sub_pd(left, right);
+    __m256d sum = _mm256_add_pd(_mm256_and_pd(left, abs_mask), _mm256_and_pd(right, abs_mask));
+    __m256d bound = _mm256_mul_pd(_mm256_set1_pd(orient2d_bound), sum);
+    unsure = _mm256_cmp_pd(_mm256_and_pd(det, abs_mask), bound, _CMP_LT_OQ);
+    pos = _mm256_cmp_pd(det, _mm256_setzero_pd(), _CMP_GT_OQ);
+    zero = _mm256_cmp_pd(det, _mm256_setzero_pd(), _CMP_EQ_OQ);
+    neg = _mm256_cmp_pd(det, _mm256_setzero_pd(), _CMP_LT_OQ);
+}
+
+// Tests the candidates of each point four at a time, fetching their corners
+// with gathers. A short last group repeats its final face, and the lanes
+// past the end are masked off, so the first face found is the same one the
+// scalar loop would find. A group with a lane the filter can't call is
+// tested again one face at a time.
+__attribute__((target("avx2")))
+static void locate_chunk_avx2(const LocateChunk &chunk)
+{
+    const FaceCorners &c = *chunk.corners;
+    for (int q = 0; q < chunk.n; q++) {
+        __m256d px = _mm256_set1_pd(chunk.points[q].x());
+        __m256d py = _mm256_set1_pd(chunk.points[q].y());
+        const int *begin, *end;
+        chunk.grid->candidateFaces(chunk.points[q], begin, end);
+        chunk.faces[q] = -1;
+        for (const int *i = begin; i < end; i += 4) {
+            int n = qMin(4, int(end - i));
+            int idx[4];
+            for (int k = 0; k < 4; k++)
+                idx[k] = i[qMin(k, n - 1)];
+            __m128i vi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(idx));
+
+            __m256d ax = _mm256_sub_pd(_mm256_i32gather_pd(c.ax.constData(), vi, 8), px);
+            __m256d ay = _mm256_sub_pd(_mm256_i32gather_pd(c.ay.constData(), vi, 8), py);
+            __m256d bx = _mm256_sub_pd(_mm256_i32gather_pd(c.bx.constData(), vi, 8), px);
+            __m256d by = _mm256_sub_pd(_mm256_i32gather_pd(c.by.constData(), vi, 8), py);
+            __m256d cx = _mm256_sub_pd(_mm256_i32gather_pd(c.cx.constData(), vi, 8), px);
+            __m256d cy = _mm256_sub_pd(_mm256_i32gather_pd(c.cy.constData(), vi, 8), py);
+
+            __m256d pos1, zero1, neg1, unsure1, pos2, zero2, neg2, unsure2;
+            __m256d pos3, zero3, neg3, unsure3;
+            sides_avx2(ax, ay, bx, by, pos1, zero1, neg1, unsure1);
+            sides_avx2(bx, by, cx, cy, pos2, zero2, neg2, unsure2);
+            sides_avx2(cx, cy, ax, ay, pos3, zero3, neg3, unsure3);
+            __m256d inside = _mm256_or_pd(
+                _mm256_and_pd(pos1, _mm256_and_pd(pos2, pos3)),
+                _mm256_or_pd(_mm256_and_pd(neg1, _mm256_and_pd(neg2, neg3)),
+                             _mm256_and_pd(zero1, _mm256_and_pd(zero2, zero3))));
+            __m256d unsure = _mm256_or_pd(unsure1, _mm256_or_pd(unsure2, unsure3));
+
+            int lanes = (1 << n) - 1;
+            if (_mm256_movemask_pd(unsure) & lanes) {
+                for (int k = 0; k < n; k++) {
+                    if (in_face(c, i[k], chunk.points[q])) {
+                        chunk.faces[q] = i[k];
+                        break;
+                    }
+                }
+                if (chunk.faces[q] != -1)
+                    break;
+                continue;
+            }
+
+            int mask = _mm256_movemask_pd(inside) & lanes;
+            if (mask) {
+                chunk.faces[q] = i[__builtin_ctz(mask)];
+                break;
+            }
+        }
+    }
+}
+
+static bool have_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+static void locate_chunk_avx2(const LocateChunk &chunk)
+{
+    locate_chunk_scalar(chunk);
+}
+
+static bool have_avx2()
+{
+    return false;
+}
+
+#endif
+
+static void locate_chunk(LocateChunk &chunk)
+{
+    if (chunk.use_avx2)
+        locate_chunk_avx2(chunk);
+    else
+        locate_chunk_scalar(chunk);
+}
+
+void locate_points(const TMapWrapper &tmap_wrapper, const QPointF *points, int n, int *faces)
+{
+    PerfScope scope("locate_points");
+    perf_count("points_located", n);
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    int n_faces = tmap.faces.size();
+    FaceCorners corners;
+    corners.ax.resize(n_faces);
+    corners.ay.resize(n_faces);
+    corners.bx.resize(n_faces);
+    corners.by.resize(n_faces);
+    corners.cx.resize(n_faces);
+    corners.cy.resize(n_faces);
+    for (int i = 0; i < n_faces; i++) {
+        QPointF u = tmap.corner(i, 0);
+        QPointF v = tmap.corner(i, 1);
+        QPointF w = tmap.corner(i, 2);
+        corners.ax[i] = u.x();
+        corners.ay[i] = u.y();
+        corners.bx[i] = v.x();
+        corners.by[i] = v.y();
+        corners.cx[i] = w.x();
+        corners.cy[i] = w.y();
+    }
+
+    static const bool use_avx2 = have_avx2();
+    QVector<LocateChunk> chunks;
+    for (int start = 0; start < n; start += chunk_size) {
+        LocateChunk chunk;
+        chunk.grid = &tmap_wrapper.grid;
+        chunk.corners = &corners;
+        chunk.points = points + start;
+        chunk.faces = faces + start;
+        chunk.n = qMin(chunk_size, n - start);
+        chunk.use_avx2 = use_avx2;
+        chunks.append(chunk);
+    }
+
+    if (chunks.size() == 1)
+        locate_chunk(chunks[0]);
+    else
+        QtConcurrent::blockingMap(chunks, locate_chunk);
+}
+
+QVector<int> locate_points(const TMapWrapper &tmap_wrapper, const QVector<QPointF> &points)
+{
+    QVector<int> faces(points.size());
+    locate_points(tmap_wrapper, points.constData(), points.size(), faces.data());
+    return faces;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "tmapwrapper.h"
+
+#include <QPointF>
+#include <QVector>
+
+// Finds the face containing each of a batch of points, for sampling weights
+// at many places at once, e.g. along paths or over a grid of probes.
+//
+// The faces come from the map's grid as with FaceGrid::faceContaining, and
+// the answers are the same, but the corners are copied into separate x and
+// y arrays so the candidates of a cell can be tested four at a time with
+// AVX2 where the processor has it. The points are split into chunks which
+// are located in parallel. Copying the corners costs a pass over the faces,
+// so the batches are best kept large.
+
+// Writes the index of the face containing points[i], or -1, to faces[i].
+void locate_points(const TMapWrapper &, const QPointF *points, int n, int *faces);
+QVector<int> locate_points(const TMapWrapper &, const QVector<QPointF> &points);
@@ -0,0 +1,19 @@
+#include "pointset.h"
+
+#include <limits>
+
+void point_set_bounds(const QVector<QPointF> &points,
+                      qreal &xmin, qreal &xmax, qreal &ymin, qreal &ymax)
+{
+    xmin = ymin = std::numeric_limits<qreal>::max();
+    xmax = ymax = -std::numeric_limits<qreal>::max();
+
+    const QPointF *p = points.constData();
+    const QPointF *end = p + points.size();
+    for (; p != end; ++p) {
+        if (p->x() < xmin) xmin = p->x();
+        if (p->x() > xmax) xmax = p->x();
+        if (p->y() < ymin) ymin = p->y();
+        if (p->y() > ymax) ymax = p->y();
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <QPointF>
+#include <QVector>
+
+// Sets the bounds to the extent of points. An empty set has no extent, and
+// gets minimums of the largest qreal and maximums of the lowest, so each
+// minimum is above its maximum.
+void point_set_bounds(const QVector<QPointF> &points,
+                      qreal &xmin, qreal &xmax, qreal &ymin, qreal &ymax);
@@ -0,0 +1,157 @@
+#include "predicates.h"
+
+#include <QVector>
+
+// A number held exactly as a sum of doubles that don't overlap, smallest
+// first, with no zero terms. An empty expansion is zero. Only the slow
+// paths use these, so they are kept simple rather than quick.
+typedef QVector<double> Expansion;
+
+// x + y == a + b exactly, with x the rounded sum.
+static inline void two_sum(double a, double b, double &x, double &y)
+{
+    x = a + b;
+    double b_virtual = x - a;
+    double a_virtual = x - b_virtual;
+    y = (a - a_virtual) + (b - b_virtual);
+}
+
+// x + y == a + b exactly, where |a| >= |b|.
+static inline void fast_two_sum(double a, double b, double &x, double &y)
+{
+    x = a + b;
+    y = b - (x - a);
+}
+
+// Splits a into two halves of 26 bits each, so their products are exact.
+static inline void split(double a, double &hi, double &lo)
+{
+    const double splitter = 134217729.0; // 2^27 + 1
+    double c = splitter * a;
+    hi = c - (c - a);
+    lo = a - hi;
+}
+
+// x + y == a * b exactly, with x the rounded product.
+static inline void two_product(double a, double b, double &x, double &y)
+{
+    x = a * b;
+    double ahi, alo, bhi, blo;
+    split(a, ahi, alo);
+    split(b, bhi, blo);
+    double err = x - ahi * bhi;
+    err -= alo * bhi;
+    err -= ahi * blo;
+    y = alo * blo - err;
+}
+
+static Expansion difference(double a, double b)
+{
+    double x, y;
+    two_sum(a, -b, x, y);
+    Expansion e;
+    if (y != 0)
+        e.append(y);
+    if (x != 0)
+        e.append(x);
+    return e;
+}
+
+static Expansion grow(const Expansion &e, double b)
+{
+    Expansion h;
+    h.reserve(e.size() + 1);
+    double q = b;
+    foreach(double term, e) {
+        double sum, low;
+        two_sum(q, term, sum, low);
+        if (low != 0)
+            h.append(low);
+        q = sum;
+    }
+    if (q != 0)
+        h.append(q);
+    return h;
+}
+
+static Expansion sum(const Expansion &e, const Expansion &f)
+{
+    Expansion h = e;
+    foreach(double term, f)
+        h = grow(h, term);
+    return h;
+}
+
+static Expansion negate(const Expansion &e)
+{
+    Expansion h = e;
+    for (int i = 0; i < h.size(); i++)
+        h[i] = -h[i];
+    return h;
+}
+
+static Expansion scale(const Expansion &e, double b)
+{
+    Expansion h;
+    if (e.isEmpty())
+        return h;
+    h.reserve(2 * e.size());
+
+    double q, low;
+    two_product(e[0], b, q, low);
+    if (low != 0)
+        h.append(low);
+    for (int i = 1; i < e.size(); i++) {
+        double high, product_low, sum;
+        two_product(e[i], b, high, product_low);
+        two_sum(q, product_low, sum, low);
+        if (low != 0)
+            h.append(low);
+        fast_two_sum(high, sum, q, low);
+        if (low != 0)
+            h.append(low);
+    }
+    if (q != 0)
+        h.append(q);
+    return h;
+}
+
+static Expansion product(const Expansion &e, const Expansion &f)
+{
+    Expansion h;
+    foreach(double term, f)
+        h = sum(h, scale(e, term));
+    return h;
+}
+
+// The largest term has the sign of the whole sum.
+static double estimate(const Expansion &e)
+{
+    return e.isEmpty() ? 0 : e.last();
+}
+
+double orient2d_exact(const QPointF &a, const QPointF &b, const QPointF &c)
+{
+    Expansion acx = difference(a.x(), c.x()), acy = difference(a.y(), c.y());
+    Expansion bcx = difference(b.x(), c.x()), bcy = difference(b.y(), c.y());
+    return estimate(sum(product(acx, bcy), negate(product(acy, bcx))));
+}
+
+double incircle_exact(const QPointF &a, const QPointF &b, const QPointF &c,
+                      const QPointF &d)
+{
+    Expansion adx = difference(a.x(), d.x()), ady = difference(a.y(), d.y());
+    Expansion bdx = difference(b.x(), d.x()), bdy = difference(b.y(), d.y());
+    Expansion cdx = difference(c.x(), d.x()), cdy = difference(c.y(), d.y());
+
+    Expansion alift = sum(product(adx, adx), product(ady, ady));
+    Expansion blift = sum(product(bdx, bdx), product(bdy, bdy));
+    Expansion clift = sum(product(cdx, cdx), product(cdy, cdy));
+
+    Expansion bc = sum(product(bdx, cdy), negate(product(cdx, bdy)));
+    Expansion ca = sum(product(cdx, ady), negate(product(adx, cdy)));
+    Expansion ab = sum(product(adx, bdy), negate(product(bdx, ady)));
+
+    Expansion det = sum(sum(product(alift, bc), product(blift, ca)), product(clift, ab));
+    return estimate(det);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QPointF>
+#include <cmath>
+
+// Orientation and in-circle tests whose signs are always right, after
+// Shewchuk's "Adaptive Precision Floating-Point Arithmetic and Fast Robust
+// Geometric Predicates". Each first works the determinant out in plain
+// doubles along with a bound on its rounding error. Only when the bound
+// says the sign could be wrong, which takes points very close to a line or
+// circle, is it worked out again in exact arithmetic. The values are only
+// estimates; their signs are what count.
+//
+// This relies on doubles being rounded to nearest with no extended
+// precision in between, as they are with SSE2.
+
+// The machine epsilon halved, 2^-53.
+const double predicate_epsilon = 1.1102230246251565e-16;
+
+// The error bounds of the plain double determinants, relative to the sum
+// of the absolute values of their terms.
+const double orient2d_bound = (3.0 + 16.0 * predicate_epsilon) * predicate_epsilon;
+const double incircle_bound = (10.0 + 96.0 * predicate_epsilon) * predicate_epsilon;
+
+double orient2d_exact(const QPointF &a, const QPointF &b, const QPointF &c);
+double incircle_exact(const QPointF &a, const QPointF &b, const QPointF &c,
+                      const QPointF &d);
+
+// Positive if a, b and c run anticlockwise, negative if they run clockwise
+// and zero if they are in a line.
+inline double orient2d(const QPointF &a, const QPointF &b, const QPointF &c)
+{
+    double left = (a.x() - c.x()) * (b.y() - c.y());
+    double right = (a.y() - c.y()) * (b.x() - c.x());
+    double det = left - right;
+
+    // If the terms differ in sign there is no cancellation to worry about.
+    double sum;
+    if (left > 0) {
+        if (right <= 0)
+            return det;
+        sum = left + right;
+    } else if (left < 0) {
+        if (right >= 0)
+            return det;
+        sum = -left - right;
+    } else {
+        return det;
+    }
+
+    double bound = orient2d_bound * sum;
+    if (det >= bound || -det >= bound)
+        return det;
+    return orient2d_exact(a, b, c);
+}
+
+// Positive if d is inside the circle through a, b and c, which run
+// anticlockwise, negative if it is outside and zero if it is on it.
+inline double incircle(const QPointF &a, const QPointF &b, const QPointF &c,
+                       const QPointF &d)
+{
+    double adx = a.x() - d.x(), ady = a.y() - d.y();
+    double bdx = b.x() - d.x(), bdy = b.y() - d.y();
+    double cdx = c.x() - d.x(), cdy = c.y() - d.y();
+
+    double bdxcdy = bdx * cdy, cdxbdy = cdx * bdy;
+    double cdxady = cdx * ady, adxcdy = adx * cdy;
+    double adxbdy = adx * bdy, bdxady = bdx * ady;
+    double alift = adx * adx + ady * ady;
+    double blift = bdx * bdx + bdy * bdy;
+    double clift = cdx * cdx + cdy * cdy;
+
+    double det = alift * (bdxcdy - cdxbdy)
+               + blift * (cdxady - adxcdy)
+               + clift * (adxbdy - bdxady);
+    double permanent = (std::fabs(bdxcdy) + std::fabs(cdxbdy)) * alift
+                     + (std::fabs(cdxady) + std::fabs(adxcdy)) * blift
+                     + (std::fabs(adxbdy) + std::fabs(bdxady)) * clift;
+
+    double bound = incircle_bound * permanent;
+    if (det > bound || -det > bound)
+        return det;
+    return incircle_exact(a, b, c, d);
+}
+
+// The sign of x, as -1, 0 or 1.
+inline int sign(double x)
+{
+    return (x > 0) - (x < 0);
+}
@@ -0,0 +1,41 @@
+#include "progress.h"
+
+Progress::Progress()
+    : stage_done(0), stage_begin(0), stage_share(0), canceled(0)
+{
+}
+
+void Progress::beginStage(int share)
+{
+    endStage();
+    stage_share = qMin(share, int(scale) - int(stage_begin));
+}
+
+void Progress::advance(qint64 part, qint64 total)
+{
+    if (total > 0)
+        stage_done.fetchAndAddRelaxed(int(stage_scale * part / total));
+}
+
+void Progress::endStage()
+{
+    stage_begin = int(stage_begin) + int(stage_share);
+    stage_share = 0;
+    stage_done = 0;
+}
+
+int Progress::value() const
+{
+    qint64 in_stage = qMin(int(stage_done), int(stage_scale));
+    return qMin(int(stage_begin) + int(in_stage * int(stage_share) / stage_scale), int(scale));
+}
+
+void Progress::cancel()
+{
+    canceled = 1;
+}
+
+bool Progress::isCanceled() const
+{
+    return canceled != 0;
+}
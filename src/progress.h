@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QtGlobal>
+
+// How far a long job such as loading a file has got, and whether whoever
+// is waiting on it wants it to give up. The job's threads report to it
+// while another thread polls it, so everything but the stage calls is safe
+// to use from any thread.
+//
+// A job is run as a series of stages, each taking up a share of the whole.
+// Functions that take a Progress report against the stage they are called
+// in, so a caller can fit them into a bigger job.
+class Progress
+{
+public:
+    // The value of a job that is done.
+    enum { scale = 1000 };
+
+    Progress();
+
+    // Starts a stage that takes share more of the job, out of scale. Called
+    // by the thread running the job, not by the stage's workers.
+    void beginStage(int share);
+    // Marks part more of the current stage's total as done.
+    void advance(qint64 part, qint64 total);
+    // Moves to the end of the current stage, whatever has been reported.
+    void endStage();
+
+    int value() const;
+
+    void cancel();
+    bool isCanceled() const;
+
+private:
+    // How much of the current stage is done, out of stage_scale.
+    enum { stage_scale = 1 << 20 };
+    QAtomicInt stage_done;
+    QAtomicInt stage_begin, stage_share;
+    QAtomicInt canceled;
+};
@@ -0,0 +1,157 @@
+#include "rasterizer.h"
+#include "maprenderer.h"
+#include "perf.h"
+
+#include <QRectF>
+#include <QVector>
+#include <QtConcurrentMap>
+#include <cstring>
+
+static const int tile_size = 256;
+
+// Corners are snapped to 1/256 of a pixel. The edge functions are then
+// exact in 64 bit integers for images up to millions of pixels across.
+static const qint64 subpixel = 256;
+
+struct RasterJob {
+    const TMapWrapper *tmap_wrapper;
+    RenderInfo ri;
+    uchar *bits;
+    int bytes_per_line;
+};
+
+struct Tile {
+    const RasterJob *job;
+    QRect rect;
+};
+
+// Rounds a / b down, for b > 0.
+static qint64 floor_div(qint64 a, qint64 b)
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+// Fills the pixels of the tile whose centres are inside the face. Each row
+// of the face is a single span, found by solving for where each edge
+// function changes sign, and filled with memset.
+static void fill_face(const Tile &tile, int face, uchar grey)
+{
+    const RasterJob &job = *tile.job;
+    const TMapWrapper &tmap_wrapper = *job.tmap_wrapper;
+    const RenderInfo &ri = job.ri;
+
+    qint64 x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        QPointF v = tmap_wrapper.tmap.corner(face, i);
+        x[i] = qRound64(((v.x() - tmap_wrapper.xmin) * ri.scale + ri.xoffset) * subpixel);
+        y[i] = qRound64(((v.y() - tmap_wrapper.ymin) * ri.scale + ri.yoffset) * subpixel);
+    }
+
+    // Order the corners so that the edge functions are positive inside.
+    qint64 area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0)
+        return;
+    if (area < 0) {
+        qSwap(x[1], x[2]);
+        qSwap(y[1], y[2]);
+    }
+
+    // The pixels with centres inside the face's bounding box, within the tile.
+    qint64 half = subpixel / 2;
+    qint64 col_lo = floor_div(qMin(x[0], qMin(x[1], x[2])) - half + subpixel - 1, subpixel);
+    qint64 col_hi = floor_div(qMax(x[0], qMax(x[1], x[2])) - half, subpixel);
+    qint64 row_lo = floor_div(qMin(y[0], qMin(y[1], y[2])) - half + subpixel - 1, subpixel);
+    qint64 row_hi = floor_div(qMax(y[0], qMax(y[1], y[2])) - half, subpixel);
+    col_lo = qMax(col_lo, qint64(tile.rect.left()));
+    col_hi = qMin(col_hi, qint64(tile.rect.right()));
+    row_lo = qMax(row_lo, qint64(tile.rect.top()));
+    row_hi = qMin(row_hi, qint64(tile.rect.bottom()));
+    if (col_lo > col_hi || row_lo > row_hi)
+        return;
+
+    // A centre exactly on an edge belongs to the face on whichever side the
+    // edge's direction picks. Neighbouring faces run along a shared edge in
+    // opposite directions, so exactly one of them gets it.
+    qint64 dx[3], dy[3], bias[3];
+    for (int k = 0; k < 3; k++) {
+        int l = (k + 1) % 3;
+        dx[k] = x[l] - x[k];
+        dy[k] = y[l] - y[k];
+        bias[k] = (dy[k] > 0 || (dy[k] == 0 && dx[k] < 0)) ? 0 : 1;
+    }
+
+    qint64 cx = col_lo * subpixel + half;
+    for (qint64 row = row_lo; row <= row_hi; row++) {
+        qint64 cy = row * subpixel + half;
+        qint64 lo = col_lo, hi = col_hi;
+        for (int k = 0; k < 3 && lo <= hi; k++) {
+            // The edge function at the pixel i to the right of col_lo is
+            // e + step * i, and the pixel is inside if that is >= 0.
+            qint64 e = dx[k] * (cy - y[k]) - dy[k] * (cx - x[k]) - bias[k];
+            qint64 step = -dy[k] * subpixel;
+            if (step > 0)
+                lo = qMax(lo, col_lo - floor_div(e, step));
+            else if (step < 0)
+                hi = qMin(hi, col_lo + floor_div(e, -step));
+            else if (e < 0)
+                hi = lo - 1;
+        }
+        if (lo <= hi)
+            memset(job.bits + row * job.bytes_per_line + lo, grey, hi - lo + 1);
+    }
+}
+
+static void rasterize_tile(Tile &tile)
+{
+    const RasterJob &job = *tile.job;
+    const TMapWrapper &tmap_wrapper = *job.tmap_wrapper;
+    const RenderInfo &ri = job.ri;
+
+    // The part of the map under the tile, with a pixel to spare.
+    QRectF visible((tile.rect.left() - 1 - ri.xoffset) / ri.scale + tmap_wrapper.xmin,
+                   (tile.rect.top() - 1 - ri.yoffset) / ri.scale + tmap_wrapper.ymin,
+                   (tile.rect.width() + 2) / ri.scale,
+                   (tile.rect.height() + 2) / ri.scale);
+    QVector<int> faces;
+    tmap_wrapper.grid.facesInRect(tmap_wrapper.tmap, visible, faces);
+
+    foreach(int i, faces)
+        fill_face(tile, i, uchar(grey_level(tmap_wrapper, tmap_wrapper.tmap.faces[i].weight)));
+}
+
+QImage rasterize_map(const TMapWrapper &tmap_wrapper, const QSize &size, float margin)
+{
+    PerfScope scope("rasterize_map");
+    QImage image(size, QImage::Format_Indexed8);
+    if (image.isNull())
+        return image;
+
+    QVector<QRgb> grey_table(256);
+    for (int i = 0; i < 256; i++)
+        grey_table[i] = qRgb(i, i, i);
+    image.setColorTable(grey_table);
+    image.fill(255);
+    if (tmap_wrapper.tmap.faces.empty())
+        return image;
+
+    RasterJob job;
+    job.tmap_wrapper = &tmap_wrapper;
+    job.ri = calc_render_info(tmap_wrapper, &image, margin);
+    job.bits = image.bits();
+    job.bytes_per_line = image.bytesPerLine();
+
+    // Tiles write disjoint pixels, so they need no locking.
+    QVector<Tile> tiles;
+    for (int y = 0; y < image.height(); y += tile_size) {
+        for (int x = 0; x < image.width(); x += tile_size) {
+            Tile tile;
+            tile.job = &job;
+            tile.rect = QRect(x, y, qMin(tile_size, image.width() - x),
+                              qMin(tile_size, image.height() - y));
+            tiles.append(tile);
+        }
+    }
+    QtConcurrent::blockingMap(tiles, rasterize_tile);
+
+    return image;
+}
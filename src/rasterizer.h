@@ -0,0 +1,16 @@
+#pragma once
+
+#include "tmapwrapper.h"
+
+#include <QImage>
+#include <QSize>
+
+// Fills the faces of the map straight into a grey 8-bit image, with the
+// same grey for each weight as render_map but without outlines, fitted to
+// the image leaving margin pixels around it. The image is split into tiles
+// which are filled in parallel, each from the faces the grid finds under it.
+//
+// A pixel belongs to the face containing its centre. Pixel centres on an
+// edge go to just one of the two faces sharing it, so there are no gaps or
+// overlaps between faces whatever their size.
+QImage rasterize_map(const TMapWrapper &, const QSize &size, float margin);
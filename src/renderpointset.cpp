@@ -1,6 +1,8 @@
 #include "renderpointset.h"
+#include "binaryformat.h"
+#include "pointset.h"
+#include "perf.h"
 
-#include <limits>
 
 RenderPointSet::RenderPointSet(QWidget *parent)
     : QWidget(parent)
@@ -10,6 +12,10 @@ RenderPointSet::RenderPointSet(QWidget *parent)
 
     xmin = ymin = actual_xmin = actual_ymin = 0;
     xmax = ymax = actual_xmax = actual_ymax = 100;
+    delaunay.build(&point_set);
+
+    point_set_loader = new PointSetLoader(this);
+    connect(point_set_loader, SIGNAL(loaded()), this, SLOT(takeLoadedPointSet()));
 }
 
 QSize RenderPointSet::minimumSizeHint() const
@@ -28,12 +34,16 @@ void RenderPointSet::addGrid(int rows, int cols)
 
     qreal xrange = xmax - xmin;
     qreal yrange = ymax - ymin;
+    int first = point_set.size();
     for (int r = 0; r < rows; r++) {
         for (int c = 0; c < cols; c++) {
             point_set.append(QPointF(xmin + c * (xrange / (cols - 1)),
                                      ymin + r * (yrange / (rows - 1))));
         }
     }
+    point_tree.build(point_set);
+    for (int i = first; i < point_set.size(); i++)
+        delaunay.insert(i, i - 1);
 
     if (need_to_update_boundary)
         update_actual_boundary();
@@ -43,28 +53,30 @@ void RenderPointSet::addGrid(int rows, int cols)
 
 void RenderPointSet::clear()
 {
+    point_set_loader->cancel();
     point_set.clear();
+    point_tree.clear();
+    delaunay.clear();
     repaint();
 }
 
+// The current point set stays up, and can still be edited, until the new
+// one has loaded.
 void RenderPointSet::open(QString path)
 {
-    QFile file(path);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
-        return;
-
-    QTextStream in(&file);
-    int n_points, n_dimensions, unknown1, unknown2;
-    in >> n_points >> n_dimensions >> unknown1 >> unknown2;
-
-    point_set.reserve(n_points);
+    point_set_loader->load(path);
+}
 
-    for (int i = 0; i < n_points; i++) {
-        int idx;
-        qreal x, y, weight;
-        in >> idx >> x >> y >> weight;
-        point_set.append(QPointF(x, y));
-    }
+void RenderPointSet::takeLoadedPointSet()
+{
+    point_set = point_set_loader->points;
+    point_tree = point_set_loader->point_tree;
+    delaunay = point_set_loader->delaunay;
+    delaunay.setPoints(&point_set);
+    // Let go of the loader's copies, so editing the points doesn't copy them.
+    point_set_loader->points.clear();
+    point_set_loader->point_tree.clear();
+    point_set_loader->delaunay.clear();
 
     update_actual_boundary();
 
@@ -80,6 +92,13 @@ void RenderPointSet::open(QString path)
 
 void RenderPointSet::save(QString path)
 {
+    if (path.endsWith(".wpb", Qt::CaseInsensitive)) {
+        QString error;
+        if (!write_binary_point_set(path, point_set, &error))
+            qWarning() << error;
+        return;
+    }
+
     QFile file(path);
     if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
         return;
@@ -147,6 +166,7 @@ void RenderPointSet::paintEvent(QPaintEvent *event)
 {
     if (point_set.empty())
         return;
+    PerfScope scope("paint_point_set");
 
     Q_ASSERT(xmin <= actual_xmin && actual_xmax <= xmax);
     Q_ASSERT(ymin <= actual_ymin && actual_ymax <= ymax);
@@ -155,6 +175,17 @@ void RenderPointSet::paintEvent(QPaintEvent *event)
     RenderInfo ri = calc_render_info();
 
     QPainter painter(this);
+
+    QVector<QLineF> edges;
+    delaunay.edges(edges);
+    for (int i = 0; i < edges.size(); i++) {
+        QPointF p1 = edges[i].p1(), p2 = edges[i].p2();
+        edges[i] = QLineF((p1.x() - xmin) * ri.scale + ri.xoffset, (p1.y() - ymin) * ri.scale + ri.yoffset,
+                          (p2.x() - xmin) * ri.scale + ri.xoffset, (p2.y() - ymin) * ri.scale + ri.yoffset);
+    }
+    painter.setPen(QColor(192, 192, 192));
+    painter.drawLines(edges);
+
     painter.setRenderHint(QPainter::Antialiasing, true);
 
     QColor color(0, 127, 0);
@@ -177,7 +208,10 @@ void RenderPointSet::mousePressEvent(QMouseEvent *event)
 
     if (event->button() == Qt::LeftButton) {
         // Add a point
+        int near = point_tree.nearest(QPointF(x, y));
         point_set.append(QPointF(x, y));
+        point_tree.insert(point_set.size() - 1, point_set.last());
+        delaunay.insert(point_set.size() - 1, near);
         update_actual_boundary();
         repaint();
     } else if (event->button() == Qt::RightButton) {
@@ -185,20 +219,16 @@ void RenderPointSet::mousePressEvent(QMouseEvent *event)
         if (point_set.empty())
             return;
 
-        QPointF q(x, y);
-        QPointF closest = q;
-        qreal closest_dist2 = std::numeric_limits<qreal>::max();
-        foreach(const QPointF &p, point_set) {
-            QPointF delta = (p - q);
-            qreal dist2 = (delta.x() * delta.x()) + (delta.y() * delta.y());
-            if (dist2 < closest_dist2) {
-                closest_dist2 = dist2;
-                closest = p;
-            }
-        }
-
-        int idx = point_set.indexOf(closest);
-        point_set.remove(idx);
+        // Fill the hole with the last point rather than shifting everything
+        // after it down, so the tree only has to relabel that one point.
+        int idx = point_tree.nearest(QPointF(x, y));
+        int last = point_set.size() - 1;
+        delaunay.remove(idx);
+        point_set[idx] = point_set[last];
+        point_set.pop_back();
+        point_tree.remove(idx);
+        point_tree.relabel(last, idx);
+        delaunay.relabel(last, idx);
         update_actual_boundary();
         repaint();
     }
@@ -207,15 +237,7 @@ void RenderPointSet::mousePressEvent(QMouseEvent *event)
 
 void RenderPointSet::update_actual_boundary()
 {
-    actual_xmin = actual_ymin = std::numeric_limits<qreal>::max();
-    actual_xmax = actual_ymax = std::numeric_limits<qreal>::min();
-
-    foreach(const QPointF &p, point_set) {
-        if (p.x() < actual_xmin) actual_xmin = p.x();
-        if (p.x() > actual_xmax) actual_xmax = p.x();
-        if (p.y() < actual_ymin) actual_ymin = p.y();
-        if (p.y() > actual_ymax) actual_ymax = p.y();
-    }
+    point_set_bounds(point_set, actual_xmin, actual_xmax, actual_ymin, actual_ymax);
 
     bool boundary_changed = false;
 #define boundary_changed_check(coord, op) \
@@ -1,5 +1,9 @@
 #pragma once
 
+#include "kdtree.h"
+#include "delaunay.h"
+#include "loader.h"
+
 #include <QtGui>
 
 class RenderPointSet : public QWidget
@@ -19,6 +23,12 @@ public:
 
     void addGrid(int rows, int cols);
 
+    const QVector<QPointF> &pointSet() const { return point_set; }
+    const DelaunayTriangulation &triangulation() const { return delaunay; }
+
+    // Loads point sets opened by path in the background.
+    Loader *loader() const { return point_set_loader; }
+
     qreal xMin() const { return xmin; }
     qreal xMax() const { return xmax; }
     qreal yMin() const { return ymin; }
@@ -37,6 +47,9 @@ public slots:
 signals:
     void boundingBoxChanged();
 
+private slots:
+    void takeLoadedPointSet();
+
 protected:
     void paintEvent(QPaintEvent *event);
     void mousePressEvent(QMouseEvent *event);
@@ -46,6 +59,10 @@ protected:
 
     QString point_set_path;
     QVector<QPointF> point_set;
+    KdTree point_tree;
+    // Kept up to date with every edit, and drawn under the points.
+    DelaunayTriangulation delaunay;
+    PointSetLoader *point_set_loader;
     qreal xmin, xmax, ymin, ymax;
     qreal actual_xmin, actual_xmax;
     qreal actual_ymin, actual_ymax;
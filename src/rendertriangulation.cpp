@@ -1,7 +1,22 @@
 #include <QtGui>
 
 #include "rendertriangulation.h"
-#include <limits>
+#include "perf.h"
+
+static const qreal min_zoom = 0.25;
+static const qreal max_zoom = 1e6;
+
+// Rendering the backbuffer goes a tile at a time, stopping for events once
+// a slice has taken this long.
+static const int refine_tile_size = 128;
+static const int refine_slice_msecs = 15;
+
+// Size in pixels of the blocks of the preview shown until tiles are rendered.
+static const int preview_step = 4;
+
+// How long weights have to be left alone before the pyramid is built again,
+// so a run of edits only starts one build.
+static const int pyramid_rebuild_msecs = 1000;
 
 RenderTriangulation::RenderTriangulation(QWidget *parent)
     : QWidget(parent)
@@ -10,6 +25,24 @@ RenderTriangulation::RenderTriangulation(QWidget *parent)
     setAutoFillBackground(true);
     setMouseTracking(true);
     last_tooltip_idx = -1;
+    last_located_idx = -1;
+    dragging = false;
+    dissolve_regions = false;
+    reset_view();
+
+    map_loader = new MapLoader(this);
+    connect(map_loader, SIGNAL(loaded()), this, SLOT(takeLoadedMap()));
+
+    pyramid_loader = new PyramidLoader(this);
+    connect(pyramid_loader, SIGNAL(loaded()), this, SLOT(takePyramid()));
+    pyramid_timer = new QTimer(this);
+    pyramid_timer->setSingleShot(true);
+    pyramid_timer->setInterval(pyramid_rebuild_msecs);
+    connect(pyramid_timer, SIGNAL(timeout()), this, SLOT(rebuildPyramid()));
+
+    refine_timer = new QTimer(this);
+    refine_timer->setInterval(0);
+    connect(refine_timer, SIGNAL(timeout()), this, SLOT(refine()));
 }
 
 QSize RenderTriangulation::minimumSizeHint() const
@@ -22,53 +55,227 @@ QSize RenderTriangulation::sizeHint() const
     return QSize(400, 200);
 }
 
-void RenderTriangulation::paintEvent(QPaintEvent*)
+void RenderTriangulation::paintEvent(QPaintEvent *event)
+{
+    PerfScope scope("paint");
+    if (backbuffer.size() != size()) {
+        backbuffer = QImage(size(), QImage::Format_ARGB32_Premultiplied);
+        unrefined.clear();
+        invalidate_backbuffer(backbuffer.rect());
+    }
+
+    QPainter painter(this);
+    painter.drawImage(event->rect(), backbuffer, event->rect());
+}
+
+void RenderTriangulation::redraw_backbuffer(const QRect &rect)
+{
+    QPainter painter(&backbuffer);
+    painter.fillRect(rect, palette().color(QPalette::Base));
+    painter.end();
+    render_map(&backbuffer, tmap_wrapper, view_render_info(), rect, &batches,
+               dissolve_regions ? &regions : 0, &pyramid);
+}
+
+void RenderTriangulation::scroll_backbuffer(QPoint delta)
+{
+    if (backbuffer.isNull())
+        return;
+
+    QImage moved(backbuffer.size(), backbuffer.format());
+    QPainter painter(&moved);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(delta, backbuffer);
+    painter.end();
+    backbuffer = moved;
+
+    // Tiles still to be rendered move along with the pixels.
+    for (int i = unrefined.size() - 1; i >= 0; i--) {
+        unrefined[i] = unrefined[i].translated(delta) & backbuffer.rect();
+        if (unrefined[i].isEmpty())
+            unrefined.removeAt(i);
+    }
+
+    // Render the strips along the edges that nothing moved into.
+    int w = backbuffer.width(), h = backbuffer.height();
+    if (delta.x() != 0)
+        invalidate_backbuffer(QRect(delta.x() > 0 ? 0 : w + delta.x(), 0, qAbs(delta.x()), h));
+    if (delta.y() != 0)
+        invalidate_backbuffer(QRect(0, delta.y() > 0 ? 0 : h + delta.y(), w, qAbs(delta.y())));
+}
+
+// Queues the rect to be rendered again in tiles, and renders the first slice
+// of them straight away, which on small maps is all of them. The tiles left
+// over get a preview until they are rendered.
+void RenderTriangulation::invalidate_backbuffer(const QRect &rect)
+{
+    QRect area = rect & backbuffer.rect();
+    if (area.isEmpty())
+        return;
+
+    QVector<QRect> tiles;
+    QVector<QPair<int, int> > order;
+    QPoint middle = backbuffer.rect().center();
+    for (int y = area.top(); y <= area.bottom(); y += refine_tile_size) {
+        for (int x = area.left(); x <= area.right(); x += refine_tile_size) {
+            QRect tile = QRect(x, y, refine_tile_size, refine_tile_size) & area;
+            QPoint d = tile.center() - middle;
+            order.append(qMakePair(d.x() * d.x() + d.y() * d.y(), tiles.size()));
+            tiles.append(tile);
+        }
+    }
+    qSort(order);
+    for (int i = 0; i < order.size(); i++)
+        unrefined.append(tiles[order[i].second]);
+
+    refine_backbuffer();
+    if (unrefined.empty())
+        return;
+
+    RenderInfo ri = view_render_info();
+    QPainter painter(&backbuffer);
+    foreach(const QRect &tile, unrefined) {
+        if (tile.intersects(area))
+            painter.fillRect(tile & area, palette().color(QPalette::Base));
+    }
+    painter.end();
+    foreach(const QRect &tile, unrefined) {
+        if (tile.intersects(area))
+            render_preview(&backbuffer, tmap_wrapper, ri, tile & area, preview_step);
+    }
+    refine_timer->start();
+}
+
+// Renders unrefined tiles until they run out or the slice's time does,
+// returning the part of the backbuffer that changed.
+QRegion RenderTriangulation::refine_backbuffer()
+{
+    QRegion refined;
+    if (unrefined.empty())
+        return refined;
+    PerfScope scope("refine");
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!unrefined.empty() && timer.elapsed() < refine_slice_msecs) {
+        QRect tile = unrefined.takeFirst();
+        redraw_backbuffer(tile);
+        refined += tile;
+    }
+    return refined;
+}
+
+void RenderTriangulation::refine()
+{
+    update(refine_backbuffer());
+    if (unrefined.empty())
+        refine_timer->stop();
+}
+
+RenderInfo RenderTriangulation::view_render_info()
+{
+    RenderInfo ri = calc_render_info(tmap_wrapper, this, widget_margin);
+    ri.scale *= zoom;
+    ri.xoffset = ri.xoffset * zoom + pan.x();
+    ri.yoffset = ri.yoffset * zoom + pan.y();
+    return ri;
+}
+
+QPointF RenderTriangulation::map_point(QPoint pos)
 {
-    render(this, widget_margin);
+    RenderInfo ri = view_render_info();
+    return QPointF((pos.x() - ri.xoffset) / ri.scale + tmap_wrapper.xmin,
+                   (pos.y() - ri.yoffset) / ri.scale + tmap_wrapper.ymin);
 }
 
+void RenderTriangulation::reset_view()
+{
+    zoom = 1;
+    pan = QPointF(0, 0);
+    backbuffer = QImage();
+}
+
+// The current map stays up until the new one has loaded.
 void RenderTriangulation::setTriangulation(QString path)
 {
-    tmap_wrapper.setMap(path);
+    map_loader->load(path);
+}
+
+void RenderTriangulation::takeLoadedMap()
+{
+    tmap_wrapper = map_loader->tmap_wrapper;
+    batches = map_loader->batches;
+    pyramid = map_loader->pyramid;
+    // Let go of the loader's copies, so editing the map doesn't copy it.
+    map_loader->tmap_wrapper = TMapWrapper();
+    map_loader->batches.clear();
+    map_loader->pyramid.clear();
+    pyramid_timer->stop();
+    pyramid_loader->cancel();
+    map_changed();
+}
+
+void RenderTriangulation::setTriangulation(const TriangulatedMap &tmap)
+{
+    map_loader->cancel();
+    tmap_wrapper.setMap(tmap);
+    batches.build(tmap_wrapper);
+    pyramid.clear();
+    pyramid_timer->stop();
+    rebuildPyramid();
+    map_changed();
+}
+
+void RenderTriangulation::rebuildPyramid()
+{
+    pyramid_loader->build(tmap_wrapper);
+}
+
+// The levels only stand in for the map, so what is already drawn is left
+// as it is.
+void RenderTriangulation::takePyramid()
+{
+    pyramid = pyramid_loader->pyramid;
+    pyramid_loader->pyramid.clear();
+}
+
+void RenderTriangulation::map_changed()
+{
+    if (dissolve_regions)
+        regions.build(tmap_wrapper.tmap);
+    last_located_idx = -1;
+    reset_view();
     repaint();
 }
 
 int RenderTriangulation::face_at_point(QPoint pos)
 {
-    if (tmap_wrapper.faces.empty())
+    if (tmap_wrapper.tmap.faces.empty())
         return -1;
-
-    RenderInfo ri = calc_render_info(this, widget_margin);
-    QPointF p((pos.x() - ri.xoffset) / ri.scale + tmap_wrapper.xmin,
-              (pos.y() - ri.yoffset) / ri.scale + tmap_wrapper.ymin);
-
-    return face_containing_point(tmap_wrapper.faces, p);
+    PerfScope scope("locate");
+
+    QPointF p = map_point(pos);
+
+    // Consecutive queries come from the mouse moving, so they are usually
+    // a few faces away from the last one we found. The grid catches points
+    // the walk can't reach, such as ones across a gap in the map.
+    int idx = walk_to_point(tmap_wrapper.tmap, p, last_located_idx);
+    if (idx == -1)
+        idx = tmap_wrapper.grid.faceContaining(tmap_wrapper.tmap, p);
+    if (idx != -1)
+        last_located_idx = idx;
+    return idx;
 }
 
 QPointF RenderTriangulation::closest_node_to_point(QPoint pos)
 {
-    if (tmap_wrapper.faces.empty())
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    if (tmap.faces.empty())
         return QPointF(-1, -1);
+    PerfScope scope("nearest_vertex");
 
-    RenderInfo ri = calc_render_info(this, widget_margin);
-    QPointF p((pos.x() - ri.xoffset) / ri.scale + tmap_wrapper.xmin,
-              (pos.y() - ri.yoffset) / ri.scale + tmap_wrapper.ymin);
-
-    QPointF closest = p;
-    qreal closest_dist2 = std::numeric_limits<qreal>::max();
-    foreach(const TriangulatedMap::Face &face, tmap_wrapper.faces) {
-        QPointF vs[3] = { face.u, face.v, face.w };
-        for (int j = 0; j < 3; j++) {
-            QPointF delta = (p - vs[j]);
-            qreal dist2 = (delta.x() * delta.x()) + (delta.y() * delta.y());
-            if (dist2 < closest_dist2) {
-                closest_dist2 = dist2;
-                closest = vs[j];
-            }
-        }
-    }
-
-    return closest;
+    QPointF p = map_point(pos);
+    return tmap.vertices[tmap_wrapper.vertex_tree.nearest(p)];
 }
 
 bool RenderTriangulation::event(QEvent *event)
@@ -84,7 +291,7 @@ bool RenderTriangulation::event(QEvent *event)
                 QToolTip::hideText();
 
             QPointF p = closest_node_to_point(helpEvent->pos());
-            qreal weight = tmap_wrapper.faces[index].weight;
+            qreal weight = tmap_wrapper.tmap.faces[index].weight;
             QToolTip::showText(helpEvent->globalPos(),
                                QString("Weight: %1\nNode: (%2, %3)")
                                .arg(weight)
@@ -99,148 +306,136 @@ bool RenderTriangulation::event(QEvent *event)
 
 void RenderTriangulation::wheelEvent(QWheelEvent *event)
 {
+    // Ctrl+wheel zooms about the cursor, keeping the point under it still.
+    if (event->modifiers() & Qt::ControlModifier) {
+        qreal factor = std::pow(1.25, event->delta() / 120.0);
+        factor = qBound(min_zoom, zoom * factor, max_zoom) / zoom;
+        QPointF c = event->pos();
+        zoom *= factor;
+        pan = (pan - c) * factor + c;
+        backbuffer = QImage();
+        update();
+        return;
+    }
+
     int idx = face_at_point(event->pos());
     if (idx < 0)
         return;
 
     qreal weight_delta = (event->delta() / 120.0) * tmap_wrapper.max_weight / 15.0;
-    qreal new_weight = tmap_wrapper.faces[idx].weight + weight_delta;
+    TriangulatedMap::Face &face = tmap_wrapper.tmap.faces[idx];
+    qreal new_weight = face.weight + weight_delta;
     if (new_weight < 0)
         new_weight = 0;
     else if (new_weight > tmap_wrapper.max_weight)
         new_weight = tmap_wrapper.max_weight;
 
-    if (new_weight != tmap_wrapper.faces[idx].weight) {
-        tmap_wrapper.faces[idx].weight = new_weight;
-        repaint();
+    if (new_weight != face.weight) {
+        face.weight = new_weight;
+        batches.faceChanged(tmap_wrapper, idx);
+        // The coarser levels no longer match the map. It is drawn in full
+        // until they have been built again once the edits stop.
+        pyramid.clear();
+        pyramid_loader->cancel();
+        pyramid_timer->start();
+        if (dissolve_regions)
+            regions.faceChanged(tmap_wrapper.tmap, idx);
+
+        // Only the face changed, so only render again the box around it and
+        // its neighbours, whose outlines it shares.
+        const TriangulatedMap &tmap = tmap_wrapper.tmap;
+        RenderInfo ri = view_render_info();
+        QPolygonF corners;
+        for (int k = -1; k < 3; k++) {
+            int f = k == -1 ? idx : (tmap.hasTopology() ? tmap.neighbours[idx].f[k] : -1);
+            if (f == -1)
+                continue;
+            for (int i = 0; i < 3; i++) {
+                QPointF v = tmap.corner(f, i);
+                corners << QPointF((v.x() - tmap_wrapper.xmin) * ri.scale + ri.xoffset,
+                                   (v.y() - tmap_wrapper.ymin) * ri.scale + ri.yoffset);
+            }
+        }
+        QRect dirty = corners.boundingRect().toAlignedRect().adjusted(-2, -2, 2, 2);
+        dirty &= rect();
+        if (!backbuffer.isNull())
+            redraw_backbuffer(dirty);
+        repaint(dirty);
     }
 }
 
-void RenderTriangulation::save(QString path)
+void RenderTriangulation::mousePressEvent(QMouseEvent *event)
 {
-    QFile file(path);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    if (event->button() != Qt::LeftButton)
         return;
 
-    QTextStream out(&file);
-    TriangulatedMap tmap;
-    tmap.faces = tmap_wrapper.faces;
-    out << tmap;
+    dragging = true;
+    last_drag_pos = event->pos();
+    setCursor(Qt::ClosedHandCursor);
 }
 
-void RenderTriangulation::renderEPS(QString path)
+void RenderTriangulation::mouseMoveEvent(QMouseEvent *event)
 {
-    if (tmap_wrapper.faces.empty())
+    if (!dragging)
         return;
 
-    // Thanks to http://www.qtcentre.org/threads/23238-QPainting-to-an-eps-file
-    // Setup printer
-    QPrinter printer(QPrinter::HighResolution);
-    printer.setOutputFormat(QPrinter::PostScriptFormat);
-    printer.setOutputFileName(path);
-
-    // Adjust paper size depending on tmap's bounding box
-    QSizeF size(tmap_wrapper.xrange, tmap_wrapper.yrange);
-    size.scale(500, 500, Qt::KeepAspectRatio);
-    printer.setPageSize(QPrinter::Custom);
-    printer.setPaperSize(size, QPrinter::Point);
-    printer.setPageMargins(0, 0, 0, 0, QPrinter::Point);
-
-    render(&printer, eps_margin);
+    // Scrolling moves the pixels already drawn, in the backbuffer and on
+    // screen, leaving just the strips uncovered along the edges to be
+    // rendered.
+    QPoint delta = event->pos() - last_drag_pos;
+    last_drag_pos = event->pos();
+    pan += delta;
+    scroll_backbuffer(delta);
+    scroll(delta.x(), delta.y());
 }
 
-RenderTriangulation::RenderInfo
-RenderTriangulation::calc_render_info(QPaintDevice *device, float margin)
+void RenderTriangulation::mouseReleaseEvent(QMouseEvent *event)
 {
-    RenderInfo ri;
-    ri.scale = std::min(float(device->width()  - margin * 2) / tmap_wrapper.xrange,
-                        float(device->height() - margin * 2) / tmap_wrapper.yrange);
-    ri.xoffset = (device->width()  - tmap_wrapper.xrange * ri.scale) / 2;
-    ri.yoffset = (device->height() - tmap_wrapper.yrange * ri.scale) / 2;
-    return ri;
-}
-
-void RenderTriangulation::render(QPaintDevice *device, float margin) {
-    if (tmap_wrapper.faces.empty())
+    if (event->button() != Qt::LeftButton)
         return;
 
-    RenderInfo ri = calc_render_info(device, margin);
-
-    QPainter painter(device);
-    painter.setRenderHint(QPainter::Antialiasing, true);
-
-    QColor color(0, 127, 0);
-    QPen pen(color);
-    painter.setPen(pen);
-
-    QPoint triangle[3];
+    dragging = false;
+    unsetCursor();
+}
 
-    foreach(const TriangulatedMap::Face &face, tmap_wrapper.faces) {
-        int grey_intensity = 255 * (tmap_wrapper.max_weight - face.weight) / tmap_wrapper.max_weight;
-        QColor color(grey_intensity, grey_intensity, grey_intensity);
-        QBrush brush(color);
-        painter.setBrush(brush);
+void RenderTriangulation::mouseDoubleClickEvent(QMouseEvent *)
+{
+    reset_view();
+    update();
+}
 
-        QPointF vertices[3] = { face.u, face.v, face.w };
-        for (int i = 0; i < 3; i++) {
-            QPointF v = vertices[i];
-            triangle[i].setX((v.x() - tmap_wrapper.xmin) * ri.scale + ri.xoffset);
-            triangle[i].setY((v.y() - tmap_wrapper.ymin) * ri.scale + ri.yoffset);
-        }
-        painter.drawConvexPolygon(triangle, 3);
-    }
+void RenderTriangulation::save(QString path)
+{
+    QString error;
+    if (!tmap_wrapper.save(path, &error))
+        qWarning() << error;
 }
 
-RenderTriangulation::TMapWrapper::TMapWrapper(QString path)
+void RenderTriangulation::renderVector(QString path)
 {
-    setMap(path);
+    VectorOptions options;
+    options.dissolve = dissolve_regions;
+    QString error;
+    if (!write_vector(path, tmap_wrapper, options, &error))
+        qWarning() << error;
 }
 
-void RenderTriangulation::TMapWrapper::setMap(QString path) {
-    if (path.isEmpty()) {
-        faces.clear();
-        return;
-    }
+void RenderTriangulation::renderImage(QString path, int size)
+{
+    if (!render_image(path, tmap_wrapper, size))
+        qWarning() << "Could not render" << path;
+}
 
-    QFile file(path);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+void RenderTriangulation::setDissolveRegions(bool dissolve)
+{
+    if (dissolve == dissolve_regions)
         return;
 
-    QTextStream in(&file);
-    TriangulatedMap tmap;
-    in >> tmap;
-    faces = tmap.faces;
-
-    xmin = ymin = std::numeric_limits<qreal>::max();
-    xmax = ymax = std::numeric_limits<qreal>::min();
-    max_weight = std::numeric_limits<qreal>::min();
-    foreach(const TriangulatedMap::Face &face, faces) {
-        QPointF vertices[3] = { face.u, face.v, face.w };
-        for (int i = 0; i < 3; i++) {
-            qreal x = vertices[i].x();
-            qreal y = vertices[i].y();
-            if (x < xmin) xmin = x;
-            if (x > xmax) xmax = x;
-            if (y < ymin) ymin = y;
-            if (y > ymax) ymax = y;
-        }
-        if (max_weight < face.weight)
-            max_weight = face.weight;
-    }
-    xrange = xmax - xmin;
-    yrange = ymax - ymin;
-
-    // Output some stats on the input
-    QMap<QPointF, bool> vertices;
-    foreach(const TriangulatedMap::Face &face, faces) {
-        vertices.insert(face.u, true);
-        vertices.insert(face.v, true);
-        vertices.insert(face.w, true);
-    }
-
-    qDebug() << "max_weight =" << max_weight;
-    qDebug() << "n_faces =" << faces.size();
-    qDebug() << "n_vertices =" << vertices.size();
-    qDebug() << "xrange =" << xrange;
-    qDebug() << "yrange =" << yrange;
+    dissolve_regions = dissolve;
+    if (dissolve)
+        regions.build(tmap_wrapper.tmap);
+    else
+        regions.clear();
+    backbuffer = QImage();
+    update();
 }
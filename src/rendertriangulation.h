@@ -1,55 +1,101 @@
 #pragma once
 
-#include "triangulatedmap.h"
+#include "tmapwrapper.h"
+#include "maprenderer.h"
+#include "facebatches.h"
+#include "faceregions.h"
+#include "mappyramid.h"
+#include "vectorwriter.h"
+#include "loader.h"
 
 #include <QWidget>
+#include <QImage>
+#include <QList>
 #include <QPaintDevice>
+#include <QRegion>
+
+class QTimer;
 
 class RenderTriangulation : public QWidget
 {
     Q_OBJECT
 
-private:
-    class TMapWrapper {
-    public:
-        TMapWrapper(QString path = QString());
-        void setMap(QString path = QString());
-
-        QVector<TriangulatedMap::Face> faces;
-        qreal xmin, xmax, ymin, ymax;
-        qreal xrange, yrange;
-        qreal max_weight;
-    };
-
-    struct RenderInfo {
-        qreal scale, xoffset, yoffset;
-    };
-
 public:
     RenderTriangulation(QWidget *parent = 0);
 
     QSize minimumSizeHint() const;
     QSize sizeHint() const;
 
+    void setTriangulation(const TriangulatedMap &tmap);
+
+    // Loads maps opened by path in the background.
+    Loader *loader() const { return map_loader; }
+
 public slots:
     void setTriangulation(QString path);
     void save(QString path);
-    void renderEPS(QString path);
+    void renderVector(QString path);
+    void renderImage(QString path, int size);
+    void setDissolveRegions(bool dissolve);
 
 protected:
     bool event(QEvent *event);
     void paintEvent(QPaintEvent *event);
     void wheelEvent(QWheelEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseReleaseEvent(QMouseEvent *event);
+    void mouseDoubleClickEvent(QMouseEvent *event);
+
+private slots:
+    void takeLoadedMap();
+    void rebuildPyramid();
+    void takePyramid();
+    void refine();
 
 private:
     static const float widget_margin = 5;
-    static const float eps_margin = 50;
 
-    RenderInfo calc_render_info(QPaintDevice *device, float margin);
-    void render(QPaintDevice *device, float margin);
+    void map_changed();
+    RenderInfo view_render_info();
+    QPointF map_point(QPoint pos);
+    void reset_view();
+    void redraw_backbuffer(const QRect &rect);
+    void scroll_backbuffer(QPoint delta);
+    void invalidate_backbuffer(const QRect &rect);
+    QRegion refine_backbuffer();
     int face_at_point(QPoint pos);
     QPointF closest_node_to_point(QPoint pos);
 
     TMapWrapper tmap_wrapper;
+    FaceBatches batches;
+    MapPyramid pyramid;
+    MapLoader *map_loader;
+    // Builds the pyramid again after edits and for maps set directly.
+    PyramidLoader *pyramid_loader;
+    QTimer *pyramid_timer;
+
+    // Only kept up to date while the map is drawn dissolved.
+    bool dissolve_regions;
+    FaceRegions regions;
     int last_tooltip_idx;
+    int last_located_idx;
+
+    // The view is the map fitted to the widget, then scaled by zoom about
+    // the top left corner and moved by pan, in pixels.
+    qreal zoom;
+    QPointF pan;
+    bool dragging;
+    QPoint last_drag_pos;
+
+    // The map as last rendered for the current view. Paint events copy from
+    // it, and it is only rendered again where the map or view has changed.
+    // A null image needs rendering from scratch.
+    QImage backbuffer;
+
+    // Tiles of the backbuffer showing only a preview, nearest the middle
+    // first. They are rendered properly a slice of time at a time, with the
+    // events that came in meanwhile handled between slices.
+    QList<QRect> unrefined;
+    QTimer *refine_timer;
 };
@@ -0,0 +1,653 @@
+#include "textreader.h"
+#include "perf.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <QtGlobal>
+#include <cstring>
+#include <limits>
+
+// Files smaller than this are parsed on the calling thread, since starting
+// up the thread pool would cost more than it saves.
+static const qint64 min_chunk_size = 1 << 20;
+
+// How often, in bytes parsed, a chunk reports progress and checks whether
+// the load has been canceled.
+static const qint64 progress_step = 1 << 20;
+
+// The contents of a file, memory mapped if possible and read in otherwise.
+class TextFile
+{
+public:
+    TextFile(const QString &path)
+        : file(path), mapped(0), begin(0), end(0) {}
+
+    ~TextFile() {
+        if (mapped)
+            file.unmap(mapped);
+    }
+
+    bool open(QString *error) {
+        if (!file.open(QIODevice::ReadOnly)) {
+            if (error)
+                *error = QString("%1: %2").arg(file.fileName()).arg(file.errorString());
+            return false;
+        }
+
+        qint64 size = file.size();
+        if (size > 0)
+            mapped = file.map(0, size);
+        if (mapped) {
+            begin = reinterpret_cast<const char *>(mapped);
+        } else {
+            buffer = file.readAll();
+            begin = buffer.constData();
+            size = buffer.size();
+        }
+        end = begin + size;
+        return true;
+    }
+
+    QFile file;
+    uchar *mapped;
+    QByteArray buffer;
+    const char *begin, *end;
+};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline const char *skip_space(const char *p, const char *end)
+{
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+// A line holds a record unless it is blank or a comment.
+static inline bool is_record(const char *p, const char *end)
+{
+    p = skip_space(p, end);
+    return p < end && *p != '#';
+}
+
+static inline const char *end_of_line(const char *p, const char *end)
+{
+    const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+    return eol ? eol : end;
+}
+
+// Reads an int starting at p, after any spaces. Returns where the number
+// ends, or 0 if there isn't a whole int there.
+static const char *parse_int(const char *p, const char *end, int &out)
+{
+    p = skip_space(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    const char *digits = p;
+    qint64 value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+        if (value > std::numeric_limits<int>::max())
+            return 0;
+    }
+
+    if (p == digits || (p < end && !is_space(*p) && *p != '#'))
+        return 0;
+
+    out = int(negative ? -value : value);
+    return p;
+}
+
+// Reads a real number starting at p, after any spaces. Returns where the
+// number ends, or 0 if there isn't one there.
+//
+// Most numbers in our files have few enough digits that the digits fit
+// exactly in a double, as does the power of ten to scale them by. A single
+// multiply or divide then gives the correctly rounded result. Anything else
+// goes through QByteArray::toDouble, which is slower but always correct.
+static const char *parse_real(const char *p, const char *end, qreal &out)
+{
+    static const qreal powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skip_space(p, end);
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    quint64 mantissa = 0;
+    int n_digits = 0;
+    int exponent = 0;
+    bool exact = true;
+    bool any_digits = false;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (n_digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0)
+                n_digits++;
+        } else {
+            exponent++;
+            exact = false;
+        }
+        any_digits = true;
+        p++;
+    }
+
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (n_digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    n_digits++;
+                exponent--;
+            } else {
+                exact = false;
+            }
+            any_digits = true;
+            p++;
+        }
+    }
+
+    if (!any_digits) {
+        // The dummy face has a weight of inf.
+        static const char *const words[] = { "infinity", "inf", "nan" };
+        for (int i = 0; i < 3; i++) {
+            int n = int(strlen(words[i]));
+            if (end - p >= n && qstrnicmp(p, words[i], n) == 0 &&
+                (p + n == end || is_space(p[n]) || p[n] == '#')) {
+                qreal value = i < 2 ? std::numeric_limits<qreal>::infinity()
+                                    : std::numeric_limits<qreal>::quiet_NaN();
+                out = negative ? -value : value;
+                return p + n;
+            }
+        }
+        return 0;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int exp;
+        const char *exp_end = p;
+        bool exp_negative = false;
+        if (exp_end < end && (*exp_end == '-' || *exp_end == '+'))
+            exp_negative = *exp_end++ == '-';
+        if (exp_end == end || *exp_end < '0' || *exp_end > '9')
+            return 0;
+        for (exp = 0; exp_end < end && *exp_end >= '0' && *exp_end <= '9'; exp_end++)
+            exp = qMin(exp * 10 + (*exp_end - '0'), 100000);
+        exponent += exp_negative ? -exp : exp;
+        p = exp_end;
+    }
+
+    if (p < end && !is_space(*p) && *p != '#')
+        return 0;
+
+    if (exact && mantissa <= (Q_UINT64_C(1) << 53) &&
+        exponent >= -22 && exponent <= 22) {
+        qreal value = qreal(mantissa);
+        if (exponent < 0)
+            value /= powers_of_ten[-exponent];
+        else
+            value *= powers_of_ten[exponent];
+        out = negative ? -value : value;
+        return p;
+    }
+
+    bool ok;
+    out = QByteArray(start, int(p - start)).toDouble(&ok);
+    return ok ? p : 0;
+}
+
+// Parses the header of a file and the records that follow it, one per line.
+class RecordParser
+{
+public:
+    virtual ~RecordParser() {}
+
+    // Parses the header [p, end) and makes room for the records after it.
+    // Returns 0 on success, with n_records set, or what the header should be.
+    virtual const char *parseHeader(const char *p, const char *end, int &n_records) = 0;
+    // Parses the line [p, end) as record number record. Returns 0 on
+    // success or a description of what is wrong with the line.
+    virtual const char *parse(int record, const char *p, const char *end) = 0;
+
+    // How many numbers the header and each record hold, for files that
+    // don't keep to one per line.
+    virtual int headerTokens() const = 0;
+    virtual int recordTokens(int record) const = 0;
+};
+
+// A slice of the file ending just after a newline, or at the end of the
+// file. The line and record numbers of its first line are filled in once
+// the lines of all the chunks before it have been counted.
+struct Chunk {
+    const char *begin, *end;
+    int n_lines, n_records;
+    int first_line, first_record, expected_records;
+    RecordParser *parser;
+    Progress *progress;
+    qint64 total_size;
+
+    int error_line;
+    const char *error;
+};
+
+static void count_chunk(Chunk &chunk)
+{
+    chunk.n_lines = chunk.n_records = 0;
+    for (const char *p = chunk.begin; p < chunk.end; ) {
+        const char *eol = end_of_line(p, chunk.end);
+        if (is_record(p, eol))
+            chunk.n_records++;
+        chunk.n_lines++;
+        p = eol + 1;
+    }
+}
+
+static void parse_chunk(Chunk &chunk)
+{
+    int line = chunk.first_line;
+    int record = chunk.first_record;
+    const char *reported = chunk.begin;
+    for (const char *p = chunk.begin; p < chunk.end; line++) {
+        if (chunk.progress && p - reported >= progress_step) {
+            chunk.progress->advance(p - reported, chunk.total_size);
+            reported = p;
+            if (chunk.progress->isCanceled())
+                return;
+        }
+
+        const char *eol = end_of_line(p, chunk.end);
+        if (is_record(p, eol)) {
+            const char *error = record < chunk.expected_records
+                ? chunk.parser->parse(record, p, eol)
+                : "unexpected data after the last record";
+            if (error) {
+                chunk.error_line = line;
+                chunk.error = error;
+                return;
+            }
+            record++;
+        }
+        p = eol + 1;
+    }
+    if (chunk.progress)
+        chunk.progress->advance(chunk.end - reported, chunk.total_size);
+}
+
+static QString line_error(const QString &path, int line, const QString &message)
+{
+    return QString("%1:%2: %3").arg(path).arg(line).arg(message);
+}
+
+// Finds the header, the first record of the file. Returns the line after it
+// and sets line to its line number, or returns 0 if the file has no header.
+static const char *find_header(const char *&p, const char *end, int &line)
+{
+    for (line = 1; p < end; line++) {
+        const char *eol = end_of_line(p, end);
+        if (is_record(p, eol))
+            return eol;
+        p = eol + 1;
+    }
+    return 0;
+}
+
+// Reads a file with one record per line, splitting the work over the
+// thread pool for large files.
+static bool read_lines(const QString &path, const TextFile &file, RecordParser &parser,
+                       QString *error, Progress *progress)
+{
+    const char *end = file.end;
+    const char *p = file.begin;
+    int header_line;
+    const char *header_end = find_header(p, end, header_line);
+    int n_records = 0;
+    const char *header_error = header_end ? parser.parseHeader(p, header_end, n_records)
+                                          : parser.parseHeader(end, end, n_records);
+    if (header_error) {
+        if (error)
+            *error = line_error(path, header_line, header_error);
+        return false;
+    }
+
+    const char *begin = header_end < end ? header_end + 1 : end;
+    qint64 size = end - begin;
+    int n_chunks = int(qBound(qint64(1), size / min_chunk_size,
+                              qint64(4 * QThread::idealThreadCount())));
+
+    QVector<Chunk> chunks;
+    p = begin;
+    for (int i = 1; i <= n_chunks && p < end; i++) {
+        const char *split = begin + size * i / n_chunks;
+        split = split < p ? p : split;
+        split = end_of_line(split, end);
+        split = split < end ? split + 1 : end;
+
+        Chunk chunk;
+        chunk.begin = p;
+        chunk.end = split;
+        chunk.expected_records = n_records;
+        chunk.parser = &parser;
+        chunk.progress = progress;
+        chunk.total_size = size;
+        chunk.error = 0;
+        chunks.append(chunk);
+        p = split;
+    }
+
+    if (chunks.size() > 1)
+        QtConcurrent::blockingMap(chunks, count_chunk);
+    else if (!chunks.empty())
+        count_chunk(chunks[0]);
+
+    int line = header_line + 1;
+    int record = 0;
+    for (int i = 0; i < chunks.size(); i++) {
+        chunks[i].first_line = line;
+        chunks[i].first_record = record;
+        line += chunks[i].n_lines;
+        record += chunks[i].n_records;
+    }
+
+    if (chunks.size() > 1)
+        QtConcurrent::blockingMap(chunks, parse_chunk);
+    else if (!chunks.empty())
+        parse_chunk(chunks[0]);
+
+    if (progress && progress->isCanceled())
+        return false;
+
+    // Report the error closest to the start of the file, as a sequential
+    // reader would have.
+    foreach(const Chunk &chunk, chunks) {
+        if (chunk.error) {
+            if (error)
+                *error = line_error(path, chunk.error_line, chunk.error);
+            return false;
+        }
+    }
+
+    if (record < n_records) {
+        if (error)
+            *error = line_error(path, qMax(line - 1, header_line),
+                                QString("file ends after %1 of %2 records")
+                                .arg(record).arg(n_records));
+        return false;
+    }
+
+    return true;
+}
+
+// Reads the numbers of a file one at a time, whatever lines they are on.
+class TokenReader
+{
+public:
+    TokenReader(const char *begin, const char *end)
+        : p(begin), end(end), line(1) {}
+
+    // Gathers the next n numbers into record, separated by spaces, and sets
+    // first_line to the line the first is on. Returns false if the file
+    // runs out first.
+    bool read(int n, QByteArray &record, int &first_line) {
+        record.clear();
+        for (int i = 0; i < n; i++) {
+            for (;;) {
+                p = skip_space(p, end);
+                if (p < end && *p == '#')
+                    p = end_of_line(p, end);
+                if (p == end)
+                    return false;
+                if (*p != '\n')
+                    break;
+                line++;
+                p++;
+            }
+            const char *token = p;
+            while (p < end && !is_space(*p) && *p != '\n' && *p != '#')
+                p++;
+            if (i == 0)
+                first_line = line;
+            record.append(token, int(p - token));
+            record.append(' ');
+        }
+        return true;
+    }
+
+    const char *p, *end;
+    int line;
+};
+
+// Reads a file token by token, as QTextStream did, for files that split
+// records over lines or put several on one. Sequential, so only for when
+// reading by lines has failed.
+static bool read_tokens(const QString &path, const TextFile &file, RecordParser &parser,
+                        QString *error, Progress *progress)
+{
+    TokenReader reader(file.begin, file.end);
+    QByteArray record;
+    int line = 1;
+    int n_records = 0;
+    bool read = reader.read(parser.headerTokens(), record, line);
+    const char *header_error = read
+        ? parser.parseHeader(record.constData(), record.constData() + record.size(), n_records)
+        : parser.parseHeader(record.constData(), record.constData(), n_records);
+    if (header_error) {
+        if (error)
+            *error = line_error(path, line, header_error);
+        return false;
+    }
+
+    const char *reported = reader.p;
+    for (int i = 0; i < n_records; i++) {
+        if (progress && reader.p - reported >= progress_step) {
+            progress->advance(reader.p - reported, file.end - file.begin);
+            reported = reader.p;
+            if (progress->isCanceled())
+                return false;
+        }
+
+        if (!reader.read(parser.recordTokens(i), record, line)) {
+            if (error)
+                *error = line_error(path, reader.line,
+                                    QString("file ends after %1 of %2 records")
+                                    .arg(i).arg(n_records));
+            return false;
+        }
+        const char *record_error = parser.parse(i, record.constData(),
+                                                record.constData() + record.size());
+        if (record_error) {
+            if (error)
+                *error = line_error(path, line, record_error);
+            return false;
+        }
+    }
+
+    if (reader.read(1, record, line)) {
+        if (error)
+            *error = line_error(path, line, "unexpected data after the last record");
+        return false;
+    }
+    return true;
+}
+
+// Reads a file by lines, falling back to reading it token by token if that
+// fails. The error from reading by lines is the one reported, since it
+// points at the line that is wrong rather than where the numbers ran out.
+static bool read_records(const QString &path, RecordParser &parser, QString *error,
+                         Progress *progress)
+{
+    TextFile file(path);
+    if (!file.open(error))
+        return false;
+
+    QString lines_error;
+    bool read = read_lines(path, file, parser, &lines_error, progress);
+    if (!read && !(progress && progress->isCanceled()))
+        read = read_tokens(path, file, parser, 0, progress);
+    if (progress && progress->isCanceled()) {
+        if (error)
+            *error = QString("%1: loading canceled").arg(path);
+        return false;
+    }
+    if (!read) {
+        if (error)
+            *error = lines_error;
+        return false;
+    }
+
+    perf_count("bytes_read", file.end - file.begin);
+    return true;
+}
+
+class TriangulationParser : public RecordParser
+{
+public:
+    TriangulationParser(TriangulatedMap &tmap) : tmap(tmap) {}
+
+    const char *parseHeader(const char *p, const char *end, int &n_records) {
+        int n_vertices, n_faces;
+        if (!(p = parse_int(p, end, n_vertices)) || !(p = parse_int(p, end, n_faces)) ||
+            is_record(p, end) || n_vertices < 0 || n_faces < 0)
+            return "expected a header: n_vertices n_faces";
+
+        tmap = TriangulatedMap();
+        tmap.vertices.resize(n_vertices);
+        tmap.vertex_faces.resize(n_vertices);
+        tmap.faces.resize(n_faces);
+        tmap.neighbours.resize(n_faces);
+        n_records = n_vertices + n_faces;
+        return 0;
+    }
+
+    int headerTokens() const { return 2; }
+    int recordTokens(int record) const { return record < tmap.vertices.size() ? 4 : 7; }
+
+    const char *parse(int record, const char *p, const char *end) {
+        int n_vertices = tmap.vertices.size();
+        int n_faces = tmap.faces.size();
+
+        if (record < n_vertices) {
+            qreal x, y, z;
+            int face_idx;
+            if (!(p = parse_real(p, end, x)) || !(p = parse_real(p, end, y)) ||
+                !(p = parse_real(p, end, z)) || !(p = parse_int(p, end, face_idx)))
+                return "expected a vertex: x y z face";
+            if (face_idx < 0 || face_idx >= n_faces)
+                return "face index out of range";
+            if (is_record(p, end))
+                return "unexpected data after the vertex";
+
+            tmap.vertices[record] = QPointF(x, y);
+            tmap.vertex_faces[record] = face_idx;
+            return 0;
+        }
+
+        int n = record - n_vertices;
+        TriangulatedMap::Face &f = tmap.faces[n];
+        TriangulatedMap::Neighbours &adj = tmap.neighbours[n];
+        for (int j = 0; j < 3; j++)
+            if (!(p = parse_int(p, end, f.v[j])))
+                return "expected a face: u v w a b c weight";
+        for (int j = 0; j < 3; j++)
+            if (!(p = parse_int(p, end, adj.f[j])))
+                return "expected a face: u v w a b c weight";
+        if (!(p = parse_real(p, end, f.weight)))
+            return "expected a face: u v w a b c weight";
+        if (is_record(p, end))
+            return "unexpected data after the face";
+
+        for (int j = 0; j < 3; j++) {
+            if (f.v[j] < 0 || f.v[j] >= n_vertices)
+                return "vertex index out of range";
+            if (adj.f[j] < 0 || adj.f[j] >= n_faces)
+                return "face index out of range";
+        }
+        return 0;
+    }
+
+private:
+    TriangulatedMap &tmap;
+};
+
+bool read_triangulation(const QString &path, TriangulatedMap &tmap, QString *error,
+                        Progress *progress)
+{
+    PerfScope scope("read_triangulation");
+    TriangulationParser parser(tmap);
+    if (!read_records(path, parser, error, progress)) {
+        tmap = TriangulatedMap();
+        return false;
+    }
+
+    compact_file_faces(tmap);
+    perf_count("faces_read", tmap.faces.size());
+    return true;
+}
+
+class PointSetParser : public RecordParser
+{
+public:
+    PointSetParser(QVector<QPointF> &points) : points(points), record_tokens(4) {}
+
+    const char *parseHeader(const char *p, const char *end, int &n_records) {
+        int n_points;
+        if (!(p = parse_int(p, end, n_points)) || n_points < 0)
+            return "expected a header: n_points dimensions attributes markers";
+
+        // The rest of the header says how many numbers follow the index of
+        // a point. Without it, assume x, y and a weight, as we write.
+        int dimensions, attributes, markers;
+        const char *q;
+        if ((q = parse_int(p, end, dimensions)) && (q = parse_int(q, end, attributes)) &&
+            parse_int(q, end, markers) && dimensions >= 2 && attributes >= 0 && markers >= 0)
+            record_tokens = 1 + dimensions + attributes + markers;
+
+        points = QVector<QPointF>(n_points);
+        n_records = n_points;
+        return 0;
+    }
+
+    const char *parse(int record, const char *p, const char *end) {
+        int idx;
+        qreal x, y;
+        if (!(p = parse_int(p, end, idx)) || !(p = parse_real(p, end, x)) ||
+            !(p = parse_real(p, end, y)))
+            return "expected a point: index x y";
+
+        points[record] = QPointF(x, y);
+        return 0;
+    }
+
+    int headerTokens() const { return 4; }
+    int recordTokens(int) const { return record_tokens; }
+
+private:
+    QVector<QPointF> &points;
+    int record_tokens;
+};
+
+bool read_point_set(const QString &path, QVector<QPointF> &points, QString *error,
+                    Progress *progress)
+{
+    PerfScope scope("read_point_set");
+    QVector<QPointF> loaded;
+    PointSetParser parser(loaded);
+    if (!read_records(path, parser, error, progress))
+        return false;
+
+    points = loaded;
+    return true;
+}
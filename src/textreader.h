@@ -0,0 +1,23 @@
+#pragma once
+
+#include "triangulatedmap.h"
+#include "progress.h"
+
+#include <QPointF>
+#include <QString>
+#include <QVector>
+
+// Fast readers for the text file formats. The file is memory mapped and
+// split at line boundaries into chunks which are parsed in parallel, one
+// record per line. They produce the same results as reading through
+// QTextStream, but on failure they return false and set error to a message
+// naming the offending line. Progress is reported within the caller's
+// current stage, and the read gives up if the progress is canceled.
+
+// Reads a weighted triangulation in the format of operator>>.
+bool read_triangulation(const QString &path, TriangulatedMap &tmap,
+                        QString *error = 0, Progress *progress = 0);
+
+// Reads the points of a .node file, ignoring any attributes and markers.
+bool read_point_set(const QString &path, QVector<QPointF> &points,
+                    QString *error = 0, Progress *progress = 0);
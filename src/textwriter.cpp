@@ -0,0 +1,451 @@
+#include "textwriter.h"
+#include "perf.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <QtGlobal>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Lines formatted by each task. A line is never longer than
+// max_line_length, which is room for six ints and a real.
+static const int chunk_lines = 65536;
+static const int max_line_length = 128;
+
+// Each pass of the radix sort sorts on this many bits of the keys. Arrays
+// shorter than min_sort_chunk per task are sorted on the calling thread.
+static const int radix_bits = 11;
+static const int radix_size = 1 << radix_bits;
+static const int min_sort_chunk = 1 << 16;
+
+// How the map is numbered in the file. Empty arrays mean the file keeps
+// the map's own numbering.
+struct FileLayout {
+    const TriangulatedMap *tmap;
+    int n_vertices;
+    // File vertex 0 is the dummy vertex rather than map vertex 0.
+    bool dummy_vertex;
+    // The map vertex written as each file vertex.
+    QVector<int> points;
+    // The file vertex at each corner of each face, three per face.
+    QVector<int> corners;
+    // The file face across the edge opposite each corner, three per face.
+    QVector<int> adjacent;
+    // A file face using each file vertex.
+    QVector<int> vertex_face;
+};
+
+struct FormatChunk {
+    const FileLayout *layout;
+    bool faces;
+    int begin, end;
+    QByteArray text;
+};
+
+char *put_int(char *p, int n)
+{
+    char digits[12];
+    int len = 0;
+    unsigned int u = n < 0 ? 0u - unsigned(n) : unsigned(n);
+    do {
+        digits[len++] = char('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (n < 0)
+        *p++ = '-';
+    while (len)
+        *p++ = digits[--len];
+    return p;
+}
+
+// Writes x as QTextStream does by default, which is printf's %g: six
+// significant digits, without trailing zeros, and in exponent form if
+// the exponent is below -4 or above 5.
+//
+// Whole numbers, as most weights are, are written as ints. Otherwise the
+// six digits are found by scaling x by a power of ten, which is one
+// rounding and so can only pick the wrong digits if x is within rounding
+// error of halfway between two of them. Those, and numbers too small or
+// large to scale exactly, go through sprintf.
+char *put_real(char *p, qreal x)
+{
+    static const qreal powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+    };
+
+    if (x == std::floor(x) && std::fabs(x) < 1e6 && (x != 0 || 1 / x > 0))
+        return put_int(p, int(x));
+
+    qreal a = std::fabs(x);
+    if (!(a >= 1e-4 && a < 1e14))
+        return p + sprintf(p, "%g", x);
+
+    int exponent = int(std::floor(std::log10(a)));
+    qreal scaled = 0;
+    for (int tries = 0; tries < 3; tries++) {
+        int shift = 5 - exponent;
+        scaled = shift >= 0 ? a * powers_of_ten[shift] : a / powers_of_ten[-shift];
+        if (scaled < 1e5)
+            exponent--;
+        else if (scaled >= 1e6)
+            exponent++;
+        else
+            break;
+    }
+    qreal whole = std::floor(scaled);
+    qreal fraction = scaled - whole;
+    if (!(whole >= 1e5 && whole < 1e6) || std::fabs(fraction - 0.5) < 1e-6)
+        return p + sprintf(p, "%g", x);
+
+    int digits = int(whole) + (fraction > 0.5 ? 1 : 0);
+    if (digits == 1000000) {
+        digits = 100000;
+        exponent++;
+    }
+
+    char text[6];
+    for (int i = 5; i >= 0; i--, digits /= 10)
+        text[i] = char('0' + digits % 10);
+    int n_digits = 6;
+    while (text[n_digits - 1] == '0')
+        n_digits--;
+
+    if (x < 0)
+        *p++ = '-';
+    if (exponent > 5) {
+        *p++ = text[0];
+        if (n_digits > 1) {
+            *p++ = '.';
+            for (int i = 1; i < n_digits; i++)
+                *p++ = text[i];
+        }
+        *p++ = 'e';
+        *p++ = '+';
+        if (exponent < 10)
+            *p++ = '0';
+        return put_int(p, exponent);
+    }
+    if (exponent < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = -1; i > exponent; i--)
+            *p++ = '0';
+        for (int i = 0; i < n_digits; i++)
+            *p++ = text[i];
+        return p;
+    }
+    for (int i = 0; i <= exponent; i++)
+        *p++ = text[i];
+    if (n_digits > exponent + 1) {
+        *p++ = '.';
+        for (int i = exponent + 1; i < n_digits; i++)
+            *p++ = text[i];
+    }
+    return p;
+}
+
+static void format_chunk(FormatChunk &chunk)
+{
+    const FileLayout &layout = *chunk.layout;
+    const TriangulatedMap &tmap = *layout.tmap;
+    chunk.text.resize((chunk.end - chunk.begin) * max_line_length);
+    char *start = chunk.text.data();
+    char *p = start;
+
+    for (int i = chunk.begin; i < chunk.end; i++) {
+        if (chunk.faces) {
+            const TriangulatedMap::Face &face = tmap.faces[i];
+            for (int j = 0; j < 3; j++) {
+                p = put_int(p, layout.corners.empty() ? face.v[j] : layout.corners[3 * i + j]);
+                *p++ = ' ';
+            }
+            for (int j = 0; j < 3; j++) {
+                p = put_int(p, layout.adjacent.empty() ? tmap.neighbours[i].f[j] + 1
+                                                       : layout.adjacent[3 * i + j]);
+                *p++ = ' ';
+            }
+            p = put_real(p, face.weight);
+        } else {
+            if (layout.dummy_vertex && i == 0) {
+                memcpy(p, "0 0", 3);
+                p += 3;
+            } else {
+                QPointF v = tmap.vertices[layout.points.empty() ? i : layout.points[i]];
+                p = put_real(p, v.x());
+                *p++ = ' ';
+                p = put_real(p, v.y());
+            }
+            memcpy(p, " 0 ", 3);
+            p = put_int(p + 3, layout.vertex_face[i]);
+        }
+        *p++ = '\n';
+    }
+
+    chunk.text.resize(int(p - start));
+}
+
+// Writes to a file, or to a stream that may not have one.
+struct Output {
+    QIODevice *device;
+    QTextStream *stream;
+
+    bool write(const QByteArray &text) {
+        if (device)
+            return device->write(text) == text.size();
+        *stream << text;
+        return stream->status() == QTextStream::Ok;
+    }
+};
+
+// Formats n vertex or face lines a batch of chunks at a time, so only a
+// few chunks' worth of text is held at once.
+static bool write_lines(Output &out, const FileLayout &layout, bool faces, int n)
+{
+    int n_tasks = 4 * QThread::idealThreadCount();
+    for (int begin = 0; begin < n; ) {
+        QVector<FormatChunk> chunks;
+        for (int t = 0; t < n_tasks && begin < n; t++) {
+            FormatChunk chunk;
+            chunk.layout = &layout;
+            chunk.faces = faces;
+            chunk.begin = begin;
+            chunk.end = qMin(n, begin + chunk_lines);
+            chunks.append(chunk);
+            begin = chunk.end;
+        }
+
+        if (chunks.size() > 1)
+            QtConcurrent::blockingMap(chunks, format_chunk);
+        else
+            format_chunk(chunks[0]);
+
+        foreach(const FormatChunk &chunk, chunks) {
+            if (!out.write(chunk.text))
+                return false;
+        }
+    }
+    return true;
+}
+
+struct RadixChunk {
+    const quint64 *keys;
+    const int *values;
+    quint64 *keys_out;
+    int *values_out;
+    int begin, end;
+    int shift;
+    QVector<int> offsets;
+};
+
+static void count_digits(RadixChunk &chunk)
+{
+    chunk.offsets.fill(0, radix_size);
+    int *counts = chunk.offsets.data();
+    for (int i = chunk.begin; i < chunk.end; i++)
+        counts[int(chunk.keys[i] >> chunk.shift) & (radix_size - 1)]++;
+}
+
+static void scatter_digits(RadixChunk &chunk)
+{
+    int *offsets = chunk.offsets.data();
+    for (int i = chunk.begin; i < chunk.end; i++) {
+        int o = offsets[int(chunk.keys[i] >> chunk.shift) & (radix_size - 1)]++;
+        chunk.keys_out[o] = chunk.keys[i];
+        chunk.values_out[o] = chunk.values[i];
+    }
+}
+
+// Sorts keys, which fit in their low bits, moving values along with them.
+// Keys that are equal keep their order. Each pass splits the array over the
+// thread pool, with every chunk counting its digits and then moving its
+// keys to where the counts before them say.
+static void radix_sort(QVector<quint64> &keys, QVector<int> &values, int bits)
+{
+    int n = keys.size();
+    QVector<quint64> keys_out(n);
+    QVector<int> values_out(n);
+    int n_chunks = qBound(1, n / min_sort_chunk, 4 * QThread::idealThreadCount());
+    QVector<RadixChunk> chunks(n_chunks);
+
+    for (int shift = 0; shift < bits; shift += radix_bits) {
+        for (int c = 0; c < n_chunks; c++) {
+            RadixChunk &chunk = chunks[c];
+            chunk.keys = keys.constData();
+            chunk.values = values.constData();
+            chunk.keys_out = keys_out.data();
+            chunk.values_out = values_out.data();
+            chunk.begin = int(qint64(n) * c / n_chunks);
+            chunk.end = int(qint64(n) * (c + 1) / n_chunks);
+            chunk.shift = shift;
+        }
+
+        if (n_chunks > 1)
+            QtConcurrent::blockingMap(chunks, count_digits);
+        else
+            count_digits(chunks[0]);
+
+        // A pass where every key has the same digit would move nothing.
+        bool all_same = false;
+        int total = 0;
+        for (int d = 0; d < radix_size; d++) {
+            int start = total;
+            for (int c = 0; c < n_chunks; c++) {
+                int count = chunks[c].offsets[d];
+                chunks[c].offsets[d] = total;
+                total += count;
+            }
+            all_same = all_same || total - start == n;
+        }
+        if (all_same)
+            continue;
+
+        if (n_chunks > 1)
+            QtConcurrent::blockingMap(chunks, scatter_digits);
+        else
+            scatter_digits(chunks[0]);
+        qSwap(keys, keys_out);
+        qSwap(values, values_out);
+    }
+}
+
+// Finds the file face across each edge of each face, given the file
+// vertices of their corners. The edges are packed into keys of their two
+// ends, smallest first, and sorted so the faces sharing an edge come
+// together. An edge no other face has gets the dummy face 0. An edge with
+// more than two faces pairs the first with the last and the rest with the
+// first, as the writer always has.
+static QVector<int> match_edges(const QVector<int> &corners, int n_vertices)
+{
+    int n = corners.size();
+    int bits = 1;
+    while (bits < 31 && (1 << bits) < n_vertices)
+        bits++;
+
+    QVector<quint64> keys(n);
+    QVector<int> half_edges(n);
+    for (int h = 0; h < n; h++) {
+        int f = h / 3, j = h % 3;
+        int a = corners[3 * f + (j + 1) % 3];
+        int b = corners[3 * f + (j + 2) % 3];
+        if (b < a)
+            qSwap(a, b);
+        keys[h] = (quint64(a) << bits) | quint64(b);
+        half_edges[h] = h;
+    }
+    radix_sort(keys, half_edges, 2 * bits);
+
+    QVector<int> adjacent(n, 0);
+    for (int i = 0; i < n; ) {
+        int k = i + 1;
+        while (k < n && keys[k] == keys[i])
+            k++;
+        if (k - i > 1) {
+            int first = half_edges[i] / 3 + 1;
+            adjacent[half_edges[i]] = half_edges[k - 1] / 3 + 1;
+            for (int m = i + 1; m < k; m++)
+                adjacent[half_edges[m]] = first;
+        }
+        i = k;
+    }
+    return adjacent;
+}
+
+// Vertices and faces keep their indices, shifted by one for faces to make
+// room for the dummy face.
+static void layout_with_topology(const TriangulatedMap &tmap, FileLayout &layout)
+{
+    layout.n_vertices = tmap.vertices.size();
+    layout.dummy_vertex = false;
+
+    // Vertices whose face was dropped on load, or that never had one, get
+    // the last face that uses them.
+    QVector<int> vertex_faces = tmap.vertex_faces;
+    if (vertex_faces.size() != tmap.vertices.size())
+        vertex_faces.fill(-1, tmap.vertices.size());
+    for (int i = 0; i < tmap.faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            int &idx = vertex_faces[tmap.faces[i].v[j]];
+            if (idx < 0 || idx >= tmap.faces.size())
+                idx = i;
+        }
+    }
+    for (int i = 0; i < vertex_faces.size(); i++)
+        vertex_faces[i]++;
+    layout.vertex_face = vertex_faces;
+}
+
+// The vertices are numbered in the order the faces use them. Index 0 is
+// reserved for the dummy vertex of the dummy face, and vertices no face
+// uses are not written out.
+static void layout_matching_edges(const TriangulatedMap &tmap, FileLayout &layout)
+{
+    int n_faces = tmap.faces.size();
+    QVector<int> vertices(tmap.vertices.size(), 0);
+    layout.points = QVector<int>(1, -1);
+    layout.corners.resize(3 * n_faces);
+    for (int i = 0; i < n_faces; i++) {
+        for (int j = 0; j < 3; j++) {
+            int v = tmap.faces[i].v[j];
+            if (vertices[v] == 0) {
+                vertices[v] = layout.points.size();
+                layout.points.append(v);
+            }
+            layout.corners[3 * i + j] = vertices[v];
+        }
+    }
+    layout.n_vertices = layout.points.size();
+    layout.dummy_vertex = true;
+
+    // Each vertex gets the last face that uses it.
+    layout.vertex_face.fill(0, layout.n_vertices);
+    for (int i = 0; i < layout.corners.size(); i++)
+        layout.vertex_face[layout.corners[i]] = i / 3 + 1;
+
+    layout.adjacent = match_edges(layout.corners, layout.n_vertices);
+}
+
+static bool write_map(Output &out, const TriangulatedMap &tmap)
+{
+    PerfScope scope("write_triangulation");
+    perf_count("faces_written", tmap.faces.size());
+    FileLayout layout;
+    layout.tmap = &tmap;
+    if (tmap.hasTopology())
+        layout_with_topology(tmap, layout);
+    else
+        layout_matching_edges(tmap, layout);
+
+    char header[32];
+    sprintf(header, "%d %d\n", layout.n_vertices, tmap.faces.size() + 1);
+    return out.write(header) &&
+           write_lines(out, layout, false, layout.n_vertices) &&
+           out.write("0 0 0 0 0 0 inf\n") &&
+           write_lines(out, layout, true, tmap.faces.size());
+}
+
+bool write_triangulation(const QString &path, const TriangulatedMap &tmap, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (error)
+            *error = QString("%1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+
+    Output out = { &file, 0 };
+    if (!write_map(out, tmap)) {
+        if (error)
+            *error = QString("%1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+    return true;
+}
+
+void write_triangulation(QTextStream &stream, const TriangulatedMap &tmap)
+{
+    Output out = { 0, &stream };
+    write_map(out, tmap);
+}
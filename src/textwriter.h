@@ -0,0 +1,25 @@
+#pragma once
+
+#include "triangulatedmap.h"
+
+#include <QString>
+#include <QTextStream>
+
+// Fast writers for the weighted triangulation text format, the counterpart
+// of textreader.h. Records are formatted on the thread pool into a buffer
+// per chunk of lines, and the buffers are written out in file order.
+//
+// A map without adjacency, such as one built in memory, has its vertices
+// numbered in the order the faces use them and its faces paired up by
+// sorting their edges, so the file has the adjacency a reader expects.
+
+bool write_triangulation(const QString &path, const TriangulatedMap &tmap,
+                         QString *error = 0);
+
+// Writes the map to a stream, as operator<< does.
+void write_triangulation(QTextStream &out, const TriangulatedMap &tmap);
+
+// Formats n or x at p as the writers do, and returns the end of the text.
+// There must be room for 32 characters.
+char *put_int(char *p, int n);
+char *put_real(char *p, qreal x);
@@ -0,0 +1,92 @@
+#include "tmapwrapper.h"
+#include "textreader.h"
+#include "binaryformat.h"
+#include "textwriter.h"
+#include "perf.h"
+
+#include <limits>
+
+TMapWrapper::TMapWrapper(QString path)
+{
+    xmin = xmax = ymin = ymax = 0;
+    xrange = yrange = 0;
+    max_weight = 0;
+    n_vertices = 0;
+    setMap(path);
+}
+
+bool TMapWrapper::setMap(QString path, QString *error) {
+    if (path.isEmpty()) {
+        tmap = TriangulatedMap();
+        grid.clear();
+        vertex_tree.clear();
+        n_vertices = 0;
+        return true;
+    }
+
+    TriangulatedMap loaded;
+    bool ok = is_binary_triangulation(path)
+        ? read_binary_triangulation(path, loaded, error)
+        : read_triangulation(path, loaded, error);
+    if (!ok)
+        return false;
+    setMap(loaded);
+    return true;
+}
+
+void TMapWrapper::setMap(const TriangulatedMap &map) {
+    tmap = map;
+
+    QVector<int> used_vertices;
+    {
+        PerfScope scope("map_stats");
+        xmin = ymin = std::numeric_limits<qreal>::max();
+        xmax = ymax = -std::numeric_limits<qreal>::max();
+        max_weight = -std::numeric_limits<qreal>::max();
+
+        // Only vertices used by some face count towards the bounding box and
+        // the stats, since the file format has a dummy vertex.
+        QVector<bool> used(tmap.vertices.size(), false);
+        foreach(const TriangulatedMap::Face &face, tmap.faces) {
+            used[face.v[0]] = used[face.v[1]] = used[face.v[2]] = true;
+            if (max_weight < face.weight)
+                max_weight = face.weight;
+        }
+
+        for (int i = 0; i < tmap.vertices.size(); i++) {
+            if (!used[i])
+                continue;
+            used_vertices.append(i);
+            qreal x = tmap.vertices[i].x();
+            qreal y = tmap.vertices[i].y();
+            if (x < xmin) xmin = x;
+            if (x > xmax) xmax = x;
+            if (y < ymin) ymin = y;
+            if (y > ymax) ymax = y;
+        }
+        xrange = xmax - xmin;
+        yrange = ymax - ymin;
+        n_vertices = used_vertices.size();
+    }
+
+    grid.build(tmap);
+    vertex_tree.build(tmap.vertices, used_vertices);
+}
+
+bool TMapWrapper::save(QString path, QString *error) const
+{
+    if (path.endsWith(".wtb", Qt::CaseInsensitive))
+        return write_binary_triangulation(path, tmap, error);
+    return write_triangulation(path, tmap, error);
+}
+
+QStringList TMapWrapper::stats() const
+{
+    QStringList lines;
+    lines << QString("max_weight = %1").arg(max_weight);
+    lines << QString("n_faces = %1").arg(tmap.faces.size());
+    lines << QString("n_vertices = %1").arg(n_vertices);
+    lines << QString("xrange = %1").arg(xrange);
+    lines << QString("yrange = %1").arg(yrange);
+    return lines;
+}
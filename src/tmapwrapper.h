@@ -0,0 +1,37 @@
+#pragma once
+
+#include "triangulatedmap.h"
+#include "facegrid.h"
+#include "kdtree.h"
+
+#include <QString>
+#include <QStringList>
+
+// A map along with its bounding box, its weight range and the indices used
+// to look up faces and vertices in it.
+class TMapWrapper {
+public:
+    TMapWrapper(QString path = QString());
+
+    // Loads the map at path, which can be in either the text or binary
+    // format. On failure the current map is kept, and error says why.
+    bool setMap(QString path = QString(), QString *error = 0);
+
+    // Takes a map built in memory, such as a triangulation of a point set.
+    void setMap(const TriangulatedMap &map);
+
+    // Saves the map, in the binary format if path ends in .wtb and in the
+    // text format otherwise.
+    bool save(QString path, QString *error = 0) const;
+
+    // Statistics about the map, one "name = value" per line.
+    QStringList stats() const;
+
+    TriangulatedMap tmap;
+    FaceGrid grid;
+    KdTree vertex_tree;
+    qreal xmin, xmax, ymin, ymax;
+    qreal xrange, yrange;
+    qreal max_weight;
+    int n_vertices;
+};
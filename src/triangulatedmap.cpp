@@ -1,208 +1,205 @@
 #include "triangulatedmap.h"
+#include "predicates.h"
+#include "textwriter.h"
 
 #include <QtAlgorithms>
 #include <QtGlobal>
-#include <QMap>
-#include <QPair>
 #include <limits>
-#include <complex>
+#include <cmath>
 
 QTextStream &operator >> (QTextStream & in, TriangulatedMap & tmap) {
-    const qreal infinity = std::numeric_limits<qreal>::infinity();
-
     int n_vertices, n_faces;
     in >> n_vertices >> n_faces;
 
-    QVector<QPointF> vertices;
-    vertices.reserve(n_vertices);
+    tmap.vertices.reserve(n_vertices);
+    tmap.vertex_faces.reserve(n_vertices);
 
     for (int n = 0; n < n_vertices; n++) {
         qreal x, y, z;
         int face_idx;
         in >> x >> y >> z >> face_idx;
-        vertices.push_back(QPointF(x, y));
+        tmap.vertices.push_back(QPointF(x, y));
+        tmap.vertex_faces.push_back(face_idx);
     }
 
+    tmap.faces.reserve(n_faces);
+    tmap.neighbours.reserve(n_faces);
+
     for (int n = 0; n < n_faces; n++) {
         TriangulatedMap::Face f;
-        int u_idx, v_idx, w_idx;
-        int a_idx, b_idx, c_idx;
-        in >> u_idx >> v_idx >> w_idx
-           >> a_idx >> b_idx >> c_idx
+        TriangulatedMap::Neighbours adj;
+        in >> f.v[0] >> f.v[1] >> f.v[2]
+           >> adj.f[0] >> adj.f[1] >> adj.f[2]
            >> f.weight;
 
-        Q_ASSERT(u_idx < vertices.size());
-        Q_ASSERT(v_idx < vertices.size());
-        Q_ASSERT(w_idx < vertices.size());
+        Q_ASSERT(f.v[0] < tmap.vertices.size());
+        Q_ASSERT(f.v[1] < tmap.vertices.size());
+        Q_ASSERT(f.v[2] < tmap.vertices.size());
 
-        f.u = vertices[u_idx];
-        f.v = vertices[v_idx];
-        f.w = vertices[w_idx];
-
-        // If this vertex has zero area, ignore it. Some of the triangulations
-        // I read in don't have enough floating point accuracy on the input,
-        // which causes zero area faces.
-        if ((f.u.x() == f.v.x() && f.u.y() == f.v.y()) ||
-            (f.u.x() == f.w.x() && f.u.y() == f.w.y()) ||
-            (f.v.x() == f.w.x() && f.v.y() == f.w.y()) ||
-            n == 0)
-            f.weight = infinity;
-
-        if (f.weight != infinity)
-            tmap.faces.push_back(f);
+        tmap.faces.push_back(f);
+        tmap.neighbours.push_back(adj);
     }
 
+    compact_file_faces(tmap);
     return in;
 }
 
-bool operator<(const QPointF & a, const QPointF & b) {
-    if (a.x() != b.x())
-        return a.x() < b.x();
-    else
-        return a.y() < b.y();
-}
-
-QTextStream &operator << (QTextStream & out, TriangulatedMap & tmap) {
-    const qreal infinity = std::numeric_limits<qreal>::infinity();
-
-    // Insert a dummy face
-    QPointF dummy_vertex(0, 0);
-    TriangulatedMap::Face dummy_face = { dummy_vertex, dummy_vertex,
-                                         dummy_vertex, infinity };
-    tmap.faces.prepend(dummy_face);
-
-    // Create a mapping from vertices to indexes. Since the dummy_face is at
-    // the front of the faces list, the dummy_vertex should also end up in the
-    // front which is what we need.
-    QMap<QPointF, int> vertices;
-    foreach(const TriangulatedMap::Face &face, tmap.faces) {
-        QPointF vs[3] = { face.u, face.v, face.w };
-        for (int i = 0; i < 3; i++)
-            if (!vertices.contains(vs[i]))
-                vertices.insert(vs[i], vertices.size());
-    }
+void compact_file_faces(TriangulatedMap & tmap) {
+    int n_faces = tmap.faces.size();
 
-    out << vertices.size() << ' ' << tmap.faces.size() << '\n';
+    // Faces we drop get no index, so we remember where each face of the file
+    // ended up and fix up the indices that refer to faces afterwards. Faces
+    // only ever move down, so this can be done in place.
+    QVector<int> face_idx(n_faces, -1);
+    int n_kept = 0;
 
-    {
-        // We need to know a face for each vertex when we output the list.
-        QVector<int> vertex_face_idx(vertices.size());
-        for (int i = 0; i < tmap.faces.size(); i++) {
-            TriangulatedMap::Face face = tmap.faces[i];
-            QPointF vs[3] = { face.u, face.v, face.w };
-            for (int j = 0; j < 3; j++)
-                vertex_face_idx[vertices[vs[j]]] = i;
-        }
+    for (int n = 0; n < n_faces; n++) {
+        const TriangulatedMap::Face &f = tmap.faces[n];
+        QPointF u = tmap.vertices[f.v[0]];
+        QPointF v = tmap.vertices[f.v[1]];
+        QPointF w = tmap.vertices[f.v[2]];
 
-        // Create a list of the vertices and sort by index so we can output
-        // the vertices in the index order.
-        QVector< QPair<int, QPointF> > points;
-        QMapIterator<QPointF, int> it(vertices);
-        while (it.hasNext()) {
-            it.next();
-            points.append(qMakePair(it.value(), it.key()));
-        }
-        qSort(points.begin(), points.end());
+        // If this face has zero area, ignore it. Some of the triangulations
+        // I read in don't have enough floating point accuracy on the input,
+        // which leaves corners on top of each other. Faces with their corners
+        // in a line are kept, so face numbering matches older versions.
+        if ((u.x() == v.x() && u.y() == v.y()) ||
+            (u.x() == w.x() && u.y() == w.y()) ||
+            (v.x() == w.x() && v.y() == w.y()) ||
+            n == 0)
+            continue;
 
-        for (int i = 0; i < points.size(); i++) {
-            QPointF p = points[i].second;
-            out << p.x() << ' ' << p.y() << " 0 "
-                << vertex_face_idx[i] << '\n';
-        }
+        face_idx[n] = n_kept;
+        tmap.faces[n_kept] = tmap.faces[n];
+        tmap.neighbours[n_kept] = tmap.neighbours[n];
+        n_kept++;
     }
 
-    {
-        // We need to know the adjacent faces for each face. We can find this
-        // by creating a mapping from edges to adjacent faces. Every face
-        // should have three adjacent faces, but if it doesnt we use the dummy
-        // face as the adjacent face.
-        typedef QPair<int, int> Edge;
-        QMap<Edge, QPair<int, int> > edges;
-        for (int i = 1; i < tmap.faces.size(); i++) {
-            TriangulatedMap::Face face = tmap.faces[i];
-            QPointF vs[3] = { face.u, face.v, face.w };
-            for (int j = 0; j < 3; j++) {
-                int a = vertices[vs[j]];
-                int b = vertices[vs[(j + 1) % 3]];
-                // If we force a <= b order then the edge (a, b) is the same
-                // as (b, a) since it will be stored as (a, b)
-                if (b < a)
-                    qSwap(a, b);
-
-                Edge edge(a, b);
-                if (edges[edge].first == 0) {
-                    edges[edge].first = i;
-                } else {
-                    Q_ASSERT(edges[edge].second == 0);
-                    edges[edge].second = i;
-                }
-            }
-        }
-
-        out << "0 0 0 0 0 0 inf\n";
-        for (int i = 1; i < tmap.faces.size(); i++) {
-            TriangulatedMap::Face face = tmap.faces[i];
-            int vs[3] = { vertices[face.u], vertices[face.v],
-                          vertices[face.w] };
-            out << vs[0] << ' ' << vs[1] << ' ' << vs[2] << ' ';
-            for (int j = 0; j < 3; j++) {
-                int a = vs[(j + 1) % 3];
-                int b = vs[(j + 2) % 3];
-                // If we force a <= b order then the edge (a, b) is the same
-                // as (b, a) since it will be stored as (a, b)
-                if (b < a)
-                    qSwap(a, b);
-
-                Edge edge(a, b);
-
-                int adjacent_idx = edges[edge].first;
-                if (adjacent_idx == i)
-                    adjacent_idx = edges[edge].second;
-
-                out << adjacent_idx << ' ';
-            }
+    tmap.faces.resize(n_kept);
+    tmap.neighbours.resize(n_kept);
 
-            out << face.weight << '\n';
+    for (int i = 0; i < n_kept; i++) {
+        for (int j = 0; j < 3; j++) {
+            int adj_idx = tmap.neighbours[i].f[j];
+            Q_ASSERT(adj_idx < n_faces);
+            tmap.neighbours[i].f[j] = face_idx[adj_idx];
         }
     }
 
+    for (int i = 0; i < tmap.vertex_faces.size(); i++) {
+        int idx = tmap.vertex_faces[i];
+        Q_ASSERT(idx < n_faces);
+        tmap.vertex_faces[i] = idx < 0 ? -1 : face_idx[idx];
+    }
+}
+
+bool operator<(const QPointF & a, const QPointF & b) {
+    if (a.x() != b.x())
+        return a.x() < b.x();
+    else
+        return a.y() < b.y();
+}
+
+QTextStream &operator << (QTextStream & out, const TriangulatedMap & tmap) {
+    write_triangulation(out, tmap);
     return out;
 }
 
 namespace CompGeom {
-    typedef std::complex<qreal> point;
-    const qreal EPS = 1e-15;
-
-    qreal cross(point a, point b) {
-        return std::imag(a * std::conj(b));
-    }
+    bool point_in_face(const TriangulatedMap &tmap, int face, const QPointF &p) {
+        QPointF a = tmap.corner(face, 0);
+        QPointF b = tmap.corner(face, 1);
+        QPointF c = tmap.corner(face, 2);
 
-    int ccw(point a, point b, point c) {
-        qreal cr = cross(b - a, c - a);
-        if(std::abs(cr) <= EPS)
-            return 0;
+        int side1 = sign(orient2d(p, a, b));
+        int side2 = sign(orient2d(p, b, c));
+        int side3 = sign(orient2d(p, c, a));
 
-        return cr > 0 ? 1 : -1;
+        return side1 == side2 && side2 == side3;
     }
+}
 
-    bool point_in_face(const TriangulatedMap::Face &f, const QPointF &p_) {
-        point a(f.u.x(), f.u.y());
-        point b(f.v.x(), f.v.y());
-        point c(f.w.x(), f.w.y());
-        point p(p_.x(), p_.y());
-
-        int side1 = ccw(p, a, b);
-        int side2 = ccw(p, b, c);
-        int side3 = ccw(p, c, a);
+int face_containing_point(const TriangulatedMap &tmap, QPointF p) {
+    for (int i = 0; i < tmap.faces.size(); i++) {
+        if (CompGeom::point_in_face(tmap, i, p))
+            return i;
+    }
+    return -1;
+}
 
-        return side1 == side2 && side2 == side3;
+// Picks a face near p to start a walk from, by checking the centroids of
+// about cbrt(n) faces spread through the face list.
+static int sample_start_face(const TriangulatedMap &tmap, QPointF p) {
+    int n_faces = tmap.faces.size();
+    int n_samples = qMax(1, int(std::pow(qreal(n_faces), qreal(1) / 3)));
+
+    int best = 0;
+    qreal best_dist2 = std::numeric_limits<qreal>::max();
+    for (int k = 0; k < n_samples; k++) {
+        int i = int(qint64(k) * n_faces / n_samples);
+        QPointF c = (tmap.corner(i, 0) + tmap.corner(i, 1) + tmap.corner(i, 2)) / 3;
+        QPointF delta = (p - c);
+        qreal dist2 = (delta.x() * delta.x()) + (delta.y() * delta.y());
+        if (dist2 < best_dist2) {
+            best_dist2 = dist2;
+            best = i;
+        }
     }
+    return best;
 }
 
-int face_containing_point(const QVector<TriangulatedMap::Face> &faces, QPointF p) {
-    for (int i = 0; i < faces.size(); i++) {
-        if (CompGeom::point_in_face(faces[i], p))
-            return i;
+int walk_to_point(const TriangulatedMap &tmap, QPointF p, int hint) {
+    if (!tmap.hasTopology())
+        return face_containing_point(tmap, p);
+    if (tmap.faces.empty())
+        return -1;
+
+    int face = hint;
+    if (face < 0 || face >= tmap.faces.size())
+        face = sample_start_face(tmap, p);
+
+    // A walk across a triangulation that isn't Delaunay can go round in
+    // circles, so we start each step at a different edge and give up once
+    // we have taken far more steps than a walk across the map needs.
+    int max_steps = 4 * int(std::sqrt(qreal(tmap.faces.size()))) + 64;
+    unsigned int rotate = 0;
+
+    for (int step = 0; step < max_steps; step++) {
+        const TriangulatedMap::Face &f = tmap.faces[face];
+        QPointF vs[3];
+        for (int j = 0; j < 3; j++)
+            vs[j] = tmap.vertices[f.v[j]];
+
+        // Faces in the file aren't all wound the same way.
+        int winding = sign(orient2d(vs[0], vs[1], vs[2]));
+        if (winding == 0)
+            return -1;
+
+        int next = -1;
+        bool blocked = false;
+        rotate = rotate * 1103515245u + 12345u;
+        for (int k = 0; k < 3; k++) {
+            int j = (k + (rotate >> 16)) % 3;
+            if (sign(orient2d(vs[(j + 1) % 3], vs[(j + 2) % 3], p)) * winding >= 0)
+                continue;
+
+            // p is on the far side of the edge opposite corner j.
+            int adj = tmap.neighbours[face].f[j];
+            if (adj == -1) {
+                blocked = true;
+            } else {
+                next = adj;
+                break;
+            }
+        }
+
+        if (next == -1) {
+            if (blocked)
+                return -1;
+            return CompGeom::point_in_face(tmap, face, p) ? face : -1;
+        }
+        face = next;
     }
+
     return -1;
 }
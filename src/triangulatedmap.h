@@ -7,17 +7,52 @@
 
 struct TriangulatedMap
 {
+    // Faces refer to their corners by index into vertices, so every vertex
+    // is stored once no matter how many faces share it.
     struct Face {
-        QPointF u, v, w;
+        int v[3];
         qreal weight;
     };
 
+    // neighbours runs parallel to faces. f[j] is the face across the edge
+    // opposite corner j, or -1 if that edge is on the boundary.
+    struct Neighbours {
+        int f[3];
+    };
+
+    QVector<QPointF> vertices;
     QVector<Face> faces;
+    QVector<Neighbours> neighbours;
+
+    // A face using each vertex, or -1 if none is known. Like neighbours this
+    // may be left empty, in which case the writer works it out.
+    QVector<int> vertex_faces;
+
+    bool hasTopology() const { return neighbours.size() == faces.size(); }
+
+    QPointF corner(int face, int j) const {
+        return vertices[faces[face].v[j]];
+    }
 };
 
 
 bool operator<(const QPointF & a, const QPointF & b);
 QTextStream &operator >> (QTextStream &, TriangulatedMap &);
-QTextStream &operator << (QTextStream &, TriangulatedMap &);
+QTextStream &operator << (QTextStream &, const TriangulatedMap &);
+
+// Takes a map holding the faces of a file in file order, dummy face 0
+// included, and drops the dummy and zero-area faces. The neighbour and
+// vertex_faces indices are renumbered to match, with -1 for dropped faces.
+void compact_file_faces(TriangulatedMap &);
+
+int face_containing_point(const TriangulatedMap &, QPointF);
+
+// Finds the face containing p by walking across neighbouring faces towards
+// it. The walk starts at hint if that is a face index, otherwise at the
+// closest of a small sample of faces. Returns -1 if p is in no face or the
+// walk gives up, e.g. on reaching the boundary of a map that isn't convex.
+int walk_to_point(const TriangulatedMap &, QPointF p, int hint = -1);
 
-int face_containing_point(const QVector<TriangulatedMap::Face> &, QPointF);
+namespace CompGeom {
+    bool point_in_face(const TriangulatedMap &, int face, const QPointF &);
+}
@@ -0,0 +1,470 @@
+#include "vectorwriter.h"
+#include "faceregions.h"
+#include "maprenderer.h"
+#include "perf.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QPolygonF>
+
+static const qreal page_size = 500;
+static const qreal page_margin = 3;
+static const int buffer_size = 1 << 16;
+static const int max_precision = 6;
+
+// Runs of faces of the same grey are written as one path of up to this
+// many triangles, a size viewers cope with well.
+static const int max_path_rings = 1000;
+
+VectorOptions::VectorOptions()
+    : dissolve(false), outlines(true), precision(2)
+{
+}
+
+// Formats the figure into a buffer, writing it out to the file whenever it
+// fills. Coordinates are integers in units of 10^-precision points, with y
+// running down the page.
+class VectorWriter
+{
+public:
+    VectorWriter(QFile &file, int precision);
+    virtual ~VectorWriter() {}
+
+    virtual void begin(qint64 width, qint64 height, bool outlines) = 0;
+    virtual void beginPath(int grey, bool even_odd) = 0;
+    virtual void ring(const QVector<qint64> &x, const QVector<qint64> &y) = 0;
+    virtual void endPath() = 0;
+    virtual void end() = 0;
+
+    bool flush();
+
+protected:
+    void put(const char *s);
+    void putInt(qint64 i, int width = 0);
+    void putFixed(qint64 q, int decimals);
+    void putCoord(qint64 q) { putFixed(q, precision); }
+    void putGrey(int grey) { putFixed(qRound(grey * 1000 / 255.0), 3); }
+    qint64 pos() const { return written + buffer.size(); }
+
+    int precision;
+    qint64 unit;
+
+private:
+    QFile &file;
+    QByteArray buffer;
+    qint64 written;
+    bool ok;
+};
+
+VectorWriter::VectorWriter(QFile &file, int precision)
+    : precision(precision), file(file), written(0), ok(true)
+{
+    unit = 1;
+    for (int i = 0; i < precision; i++)
+        unit *= 10;
+}
+
+bool VectorWriter::flush()
+{
+    if (!buffer.isEmpty()) {
+        ok = ok && file.write(buffer) == buffer.size();
+        written += buffer.size();
+        buffer.clear();
+    }
+    return ok;
+}
+
+void VectorWriter::put(const char *s)
+{
+    buffer.append(s);
+    if (buffer.size() >= buffer_size)
+        flush();
+}
+
+// Writes a non-negative integer, padded with zeros to width digits.
+void VectorWriter::putInt(qint64 i, int width)
+{
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = '0' + i % 10;
+        i /= 10;
+    } while (i > 0 || n < width);
+    while (n > 0)
+        buffer.append(digits[--n]);
+}
+
+// Writes q / 10^decimals with as few digits as it takes.
+void VectorWriter::putFixed(qint64 q, int decimals)
+{
+    if (q < 0) {
+        buffer.append('-');
+        q = -q;
+    }
+    qint64 scale = 1;
+    for (int i = 0; i < decimals; i++)
+        scale *= 10;
+    putInt(q / scale);
+
+    qint64 frac = q % scale;
+    if (frac == 0)
+        return;
+    while (frac % 10 == 0) {
+        frac /= 10;
+        decimals--;
+    }
+    buffer.append('.');
+    putInt(frac, decimals);
+}
+
+class EpsWriter : public VectorWriter
+{
+public:
+    EpsWriter(QFile &file, int precision) : VectorWriter(file, precision) {}
+
+    void begin(qint64 width, qint64 height, bool outlines)
+    {
+        put("%!PS-Adobe-3.0 EPSF-3.0\n%%BoundingBox: 0 0 ");
+        putInt((width + unit - 1) / unit);
+        put(" ");
+        putInt((height + unit - 1) / unit);
+        put("\n%%HiResBoundingBox: 0 0 ");
+        putCoord(width);
+        put(" ");
+        putCoord(height);
+        put("\n%%Creator: Weighted Triangulation Editor\n%%EndComments\n");
+        put("/m {moveto} bind def /l {lineto} bind def /h {closepath} bind def /g {setgray} bind def\n");
+        if (outlines) {
+            put("/f {gsave fill grestore 0 0.498 0 setrgbcolor stroke} bind def\n"
+                "/F {gsave eofill grestore 0 0.498 0 setrgbcolor stroke} bind def\n"
+                "0 setlinewidth 1 setlinejoin\n");
+        } else {
+            put("/f {fill} bind def /F {eofill} bind def\n");
+        }
+        put("0 ");
+        putCoord(height);
+        put(" translate 1 -1 scale\n");
+    }
+
+    void beginPath(int grey, bool even_odd)
+    {
+        this->even_odd = even_odd;
+        putGrey(grey);
+        put(" g\n");
+    }
+
+    void ring(const QVector<qint64> &x, const QVector<qint64> &y)
+    {
+        for (int i = 0; i < x.size(); i++) {
+            putCoord(x[i]);
+            put(" ");
+            putCoord(y[i]);
+            put(i == 0 ? " m " : " l ");
+        }
+        put("h\n");
+    }
+
+    void endPath()
+    {
+        put(even_odd ? "F\n" : "f\n");
+    }
+
+    void end()
+    {
+        put("showpage\n%%EOF\n");
+    }
+
+private:
+    bool even_odd;
+};
+
+class SvgWriter : public VectorWriter
+{
+public:
+    SvgWriter(QFile &file, int precision) : VectorWriter(file, precision) {}
+
+    void begin(qint64 width, qint64 height, bool outlines)
+    {
+        put("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" width=\"");
+        putCoord(width);
+        put("pt\" height=\"");
+        putCoord(height);
+        put("pt\" viewBox=\"0 0 ");
+        putCoord(width);
+        put(" ");
+        putCoord(height);
+        put("\">\n");
+        if (outlines)
+            put("<g stroke=\"#007f00\" stroke-width=\"0.1\" stroke-linejoin=\"round\">\n");
+        else
+            put("<g stroke=\"none\">\n");
+    }
+
+    void beginPath(int grey, bool even_odd)
+    {
+        static const char hex[] = "0123456789abcdef";
+        char colour[8] = { '#', 0, 0, 0, 0, 0, 0, 0 };
+        for (int i = 0; i < 3; i++) {
+            colour[1 + 2 * i] = hex[grey >> 4];
+            colour[2 + 2 * i] = hex[grey & 15];
+        }
+        put("<path fill=\"");
+        put(colour);
+        put(even_odd ? "\" fill-rule=\"evenodd\" d=\"" : "\" d=\"");
+    }
+
+    void ring(const QVector<qint64> &x, const QVector<qint64> &y)
+    {
+        for (int i = 0; i < x.size(); i++) {
+            put(i == 0 ? "M" : "L");
+            putCoord(x[i]);
+            put(" ");
+            putCoord(y[i]);
+        }
+        put("Z");
+    }
+
+    void endPath()
+    {
+        put("\"/>\n");
+    }
+
+    void end()
+    {
+        put("</g>\n</svg>\n");
+    }
+};
+
+// Writes a single page PDF, keeping just the offsets of its few objects for
+// the cross-reference table at the end.
+class PdfWriter : public VectorWriter
+{
+public:
+    PdfWriter(QFile &file, int precision) : VectorWriter(file, precision) {}
+
+    void begin(qint64 width, qint64 height, bool outlines)
+    {
+        this->outlines = outlines;
+        put("%PDF-1.4\n%\xe2\xe3\xcf\xd3\n");
+        beginObject(1);
+        put("<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+        beginObject(2);
+        put("<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+        beginObject(3);
+        put("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 ");
+        putCoord(width);
+        put(" ");
+        putCoord(height);
+        put("] /Resources << >> /Contents 4 0 R >>\nendobj\n");
+
+        // The length of the content comes after it, in object 5.
+        beginObject(4);
+        put("<< /Length 5 0 R >>\nstream\n");
+        stream_start = pos();
+        put("1 0 0 -1 0 ");
+        putCoord(height);
+        put(" cm\n");
+        if (outlines)
+            put("0 w 1 j 0 0.498 0 RG\n");
+    }
+
+    void beginPath(int grey, bool even_odd)
+    {
+        this->even_odd = even_odd;
+        putGrey(grey);
+        put(" g\n");
+    }
+
+    void ring(const QVector<qint64> &x, const QVector<qint64> &y)
+    {
+        for (int i = 0; i < x.size(); i++) {
+            putCoord(x[i]);
+            put(" ");
+            putCoord(y[i]);
+            put(i == 0 ? " m " : " l ");
+        }
+        put("h\n");
+    }
+
+    void endPath()
+    {
+        if (outlines)
+            put(even_odd ? "B*\n" : "B\n");
+        else
+            put(even_odd ? "f*\n" : "f\n");
+    }
+
+    void end()
+    {
+        qint64 length = pos() - stream_start;
+        put("\nendstream\nendobj\n");
+        beginObject(5);
+        putInt(length);
+        put("\nendobj\n");
+
+        qint64 xref = pos();
+        put("xref\n0 6\n0000000000 65535 f \n");
+        for (int i = 1; i <= 5; i++) {
+            putInt(offsets[i], 10);
+            put(" 00000 n \n");
+        }
+        put("trailer\n<< /Size 6 /Root 1 0 R >>\nstartxref\n");
+        putInt(xref);
+        put("\n%%EOF\n");
+    }
+
+private:
+    void beginObject(int n)
+    {
+        offsets[n] = pos();
+        putInt(n);
+        put(" 0 obj\n");
+    }
+
+    bool outlines;
+    bool even_odd;
+    qint64 stream_start;
+    qint64 offsets[6];
+};
+
+bool is_vector_format(const QString &path)
+{
+    QString suffix = QFileInfo(path).suffix().toLower();
+    return suffix == "eps" || suffix == "svg" || suffix == "pdf";
+}
+
+// Places the map on the page, in the writer's units.
+struct PageTransform {
+    qreal xmin, ymin, scale;
+    qint64 unit;
+
+    qint64 x(qreal x) const { return qRound64(((x - xmin) * scale + page_margin) * unit); }
+    qint64 y(qreal y) const { return qRound64(((y - ymin) * scale + page_margin) * unit); }
+};
+
+// Rounds the ring to the page, dropping points that land on the one before.
+static void quantise_ring(const PageTransform &page, const QPolygonF &ring,
+                          QVector<qint64> &x, QVector<qint64> &y)
+{
+    x.resize(0);
+    y.resize(0);
+    foreach(const QPointF &p, ring) {
+        qint64 px = page.x(p.x()), py = page.y(p.y());
+        if (!x.empty() && x.last() == px && y.last() == py)
+            continue;
+        x.append(px);
+        y.append(py);
+    }
+    while (x.size() > 1 && x.last() == x.first() && y.last() == y.first()) {
+        x.resize(x.size() - 1);
+        y.resize(y.size() - 1);
+    }
+}
+
+static void write_faces(VectorWriter &writer, const TMapWrapper &tmap_wrapper,
+                        const PageTransform &page)
+{
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    QVector<qint64> x(3), y(3);
+    int path_grey = -1, path_rings = 0;
+    for (int i = 0; i < tmap.faces.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+            QPointF v = tmap.corner(i, j);
+            x[j] = page.x(v.x());
+            y[j] = page.y(v.y());
+        }
+        if ((x[1] - x[0]) * (y[2] - y[0]) == (y[1] - y[0]) * (x[2] - x[0]))
+            continue;
+
+        int grey = grey_level(tmap_wrapper, tmap.faces[i].weight);
+        if (grey != path_grey || path_rings == max_path_rings) {
+            if (path_grey != -1)
+                writer.endPath();
+            writer.beginPath(grey, false);
+            path_grey = grey;
+            path_rings = 0;
+        }
+        writer.ring(x, y);
+        path_rings++;
+    }
+    if (path_grey != -1)
+        writer.endPath();
+}
+
+static void write_regions(VectorWriter &writer, const TMapWrapper &tmap_wrapper,
+                          const PageTransform &page)
+{
+    const TriangulatedMap &tmap = tmap_wrapper.tmap;
+    FaceRegions regions;
+    regions.build(tmap);
+
+    QVector<qint64> x, y;
+    foreach(int region, regions.regionIds()) {
+        bool begun = false;
+        foreach(const QPolygonF &ring, regions.regionOutline(tmap, region)) {
+            quantise_ring(page, ring, x, y);
+            if (x.size() < 3)
+                continue;
+            if (!begun) {
+                writer.beginPath(grey_level(tmap_wrapper, regions.regionWeight(region)), true);
+                begun = true;
+            }
+            writer.ring(x, y);
+        }
+        if (begun)
+            writer.endPath();
+    }
+}
+
+bool write_vector(const QString &path, const TMapWrapper &tmap_wrapper,
+                  const VectorOptions &options, QString *error)
+{
+    PerfScope scope("write_vector");
+    if (tmap_wrapper.tmap.faces.empty()) {
+        if (error)
+            *error = QString("%1: no map to write").arg(path);
+        return false;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error)
+            *error = QString("%1: %2").arg(path).arg(file.errorString());
+        return false;
+    }
+
+    int precision = qBound(0, options.precision, max_precision);
+    QString suffix = QFileInfo(path).suffix().toLower();
+    VectorWriter *writer;
+    if (suffix == "svg")
+        writer = new SvgWriter(file, precision);
+    else if (suffix == "pdf")
+        writer = new PdfWriter(file, precision);
+    else
+        writer = new EpsWriter(file, precision);
+
+    PageTransform page;
+    page.xmin = tmap_wrapper.xmin;
+    page.ymin = tmap_wrapper.ymin;
+    page.scale = page_size / qMax(tmap_wrapper.xrange, tmap_wrapper.yrange);
+    page.unit = 1;
+    for (int i = 0; i < precision; i++)
+        page.unit *= 10;
+
+    writer->begin(qRound64((tmap_wrapper.xrange * page.scale + 2 * page_margin) * page.unit),
+                  qRound64((tmap_wrapper.yrange * page.scale + 2 * page_margin) * page.unit),
+                  options.outlines);
+    if (options.dissolve)
+        write_regions(*writer, tmap_wrapper, page);
+    else
+        write_faces(*writer, tmap_wrapper, page);
+    writer->end();
+
+    bool ok = writer->flush();
+    delete writer;
+    if (!ok && error)
+        *error = QString("%1: %2").arg(path).arg(file.errorString());
+    return ok;
+}
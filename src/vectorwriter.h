@@ -0,0 +1,27 @@
+#pragma once
+
+#include "tmapwrapper.h"
+
+#include <QString>
+
+// Streams a map straight to an EPS, SVG or PDF file, picked by the file's
+// extension. Faces, or regions when dissolving, are formatted as they are
+// visited and written out through a small buffer, so the writer's memory
+// use does not grow with the map. Only dissolving needs memory in
+// proportion to the map, for the regions.
+//
+// The figure is 500 points on its longest side. Coordinates are rounded to
+// the given number of decimal places, and faces that collapse to nothing at
+// that precision are left out.
+
+struct VectorOptions {
+    VectorOptions();
+
+    bool dissolve;
+    bool outlines;
+    int precision;
+};
+
+bool is_vector_format(const QString &path);
+bool write_vector(const QString &path, const TMapWrapper &,
+                  const VectorOptions &options = VectorOptions(), QString *error = 0);